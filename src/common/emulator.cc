@@ -1,6 +1,7 @@
 #include <common/emulator.h>
 #include <common/sif.h>
 #include <cpu/ee/ee.h>
+#include <cpu/ee/jit/jit.h>
 #include <cpu/ee/intc.h>
 #include <cpu/ee/dmac.h>
 #include <cpu/iop/iop.h>
@@ -13,7 +14,10 @@
 #include <spu/spu.h>
 #include <media/cdvd.h>
 #include <media/sio2.h>
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <x86intrin.h>
 
 int cycles_executed = 0;
 
@@ -112,6 +116,32 @@ namespace common
             uint32_t p_align;
         };
 
+        /* Section header */
+        struct Elf32_Shdr
+        {
+            uint32_t sh_name;
+            uint32_t sh_type;
+            uint32_t sh_flags;
+            uint32_t sh_addr;
+            uint32_t sh_offset;
+            uint32_t sh_size;
+            uint32_t sh_link;
+            uint32_t sh_info;
+            uint32_t sh_addralign;
+            uint32_t sh_entsize;
+        };
+
+        /* Symbol table entry */
+        struct Elf32_Sym
+        {
+            uint32_t st_name;
+            uint32_t st_value;
+            uint32_t st_size;
+            uint8_t  st_info;
+            uint8_t  st_other;
+            uint16_t st_shndx;
+        };
+
         std::ifstream reader;
         reader.open(filename, std::ios::in | std::ios::binary);
 
@@ -153,7 +183,35 @@ namespace common
                     mem_w += 4;
                 }
             }
-            
+
+            /* Name the JIT blocks after the functions in the symbol table, if there is one.
+               Tables that don't fit in the file are skipped */
+            auto in_file = [size](uint64_t offset, uint64_t length) { return offset + length <= (uint64_t)size; };
+            bool sections = in_file(header.e_shoff, (uint64_t)header.e_shnum * sizeof(Elf32_Shdr));
+
+            auto& perf_map = ee->compiler->perf_map;
+            for (int i = 0; perf_map.enabled() && sections && i < header.e_shnum; i++)
+            {
+                auto sheader = *(Elf32_Shdr*)&buffer[header.e_shoff + i * sizeof(Elf32_Shdr)];
+                if (sheader.sh_type != 2 || sheader.sh_link >= header.e_shnum)
+                    continue;
+
+                auto strtab = *(Elf32_Shdr*)&buffer[header.e_shoff + sheader.sh_link * sizeof(Elf32_Shdr)];
+                if (!in_file(sheader.sh_offset, sheader.sh_size) || !in_file(strtab.sh_offset, strtab.sh_size))
+                    continue;
+
+                for (auto sym_w = sheader.sh_offset; sym_w + sizeof(Elf32_Sym) <= sheader.sh_offset + sheader.sh_size; sym_w += sizeof(Elf32_Sym))
+                {
+                    auto symbol = *(Elf32_Sym*)&buffer[sym_w];
+                    if ((symbol.st_info & 0xF) != 2 || !symbol.st_size || symbol.st_name >= strtab.sh_size)
+                        continue;
+
+                    /* The name might not be terminated inside the table */
+                    auto name = (const char*)&buffer[strtab.sh_offset + symbol.st_name];
+                    perf_map.add_symbol(symbol.st_value, symbol.st_size, std::string(name, strnlen(name, strtab.sh_size - symbol.st_name)));
+                }
+            }
+
             ee->pc = header.e_entry;
             ee->fetch_next();
             ee->print_pc = true;
@@ -164,6 +222,23 @@ namespace common
         return false;
     }
 
+    HandlerBase* Emulator::find_handler(uint32_t paddr, bool write)
+    {
+        /* VU memory and the BIOS are checked before the handler table */
+        if (paddr >= 0x11000000 && paddr < 0x11010000)
+            return nullptr;
+        else if (!write && paddr >= 0x1fc00000)
+            return nullptr;
+        else if (write && paddr >= 0x1fff8000 && paddr < 0x20000000)
+            return nullptr;
+
+        /* Addresses calculate_page would reject */
+        if ((paddr & 0x000f0000) != 0 && (paddr & 0x1fff0000) != 0x1ffe0000)
+            return nullptr;
+
+        return handlers[calculate_page(paddr)];
+    }
+
     void Emulator::read_bios()
     {
         /* Yes it's hardcoded for now, don't bite me, I'll change it eventually */
@@ -178,30 +253,46 @@ namespace common
         reader.close();
     }
 
+    uint32_t Emulator::next_timeslice(uint32_t total_cycles, bool vblank_started)
+    {
+        uint32_t vblank = vblank_started ? CYCLES_PER_FRAME : CYCLES_VBLANK_OFF;
+        uint32_t cycles = std::min(vblank - total_cycles, MAX_CYCLES_PER_TICK);
+
+        /* The EE timers count BUSCLK cycles */
+        uint64_t timer = (uint64_t)ee->timers.cycles_until_event() * 2;
+        return std::min<uint64_t>(cycles, timer);
+    }
+
     void Emulator::tick()
     {
-        uint32_t total_cycles = 0;
+        /* The JIT profiler measures blocks against the whole frame */
+        auto& profiler = ee->compiler->profiler;
+        uint64_t start = profiler.enabled() ? __rdtsc() : 0;
+
+        uint32_t total_cycles = frame_overshoot;
         bool vblank_started = false;
         while (total_cycles < CYCLES_PER_FRAME)
         {
-            uint32_t cycles = CYCLES_PER_TICK;
-
-            /* Tick componets that run at EE speed */
-            ee->tick(cycles);
-
-            /* Tick bus components */
-            cycles /= 2;
+            /* Tick componets that run at EE speed. The timeslice
+               might end early or overshoot by a few cycles */
+            uint32_t cycles = next_timeslice(total_cycles, vblank_started);
+            uint32_t executed = ee->tick(cycles);
+            uint32_t end = total_cycles + executed;
+
+            /* Tick bus components. Divide the totals rather than the
+               timeslice, so uneven timeslices don't lose cycles */
+            cycles = end / 2 - total_cycles / 2;
             dmac->tick(cycles);
             vif[0]->tick(cycles);
             vif[1]->tick(cycles);
             gif->tick(cycles);
 
             /* Tick IOP components */
-            cycles /= 4;
+            cycles = end / 8 - total_cycles / 8;
             iop->tick(cycles);
             iop_dma->tick(cycles);
 
-            total_cycles += CYCLES_PER_TICK;
+            total_cycles = end;
 
             if (!vblank_started && total_cycles >= CYCLES_VBLANK_OFF)
             {
@@ -220,10 +311,15 @@ namespace common
             }
         }
 
+        frame_overshoot = total_cycles - CYCLES_PER_FRAME;
+
         /* VBlank end */
         iop->intr.trigger(iop::Interrupt::VBLANKEnd);
         ee->intc.trigger(ee::Interrupt::INT_VB_OFF);
         vblank_started = false;
         gs->priv_regs.csr.vsint = false;
+
+        if (profiler.enabled())
+            profiler.add_frame_time(__rdtsc() - start);
     }
 }
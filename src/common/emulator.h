@@ -64,7 +64,10 @@ namespace common
     constexpr uint32_t CYCLES_PER_FRAME = 4919808; /* VBLANK ON + VBLANK OFF */
     constexpr uint32_t CYCLES_VBLANK_ON = 421376;
     constexpr uint32_t CYCLES_VBLANK_OFF = 4498432;
-    constexpr uint32_t CYCLES_PER_TICK = 32;
+
+    /* The EE runs up to the next scheduled event, but never longer than this
+       without letting the bus and the IOP catch up */
+    constexpr uint32_t MAX_CYCLES_PER_TICK = 2048;
 
     enum ComponentID
     {
@@ -97,6 +100,9 @@ namespace common
         void add_handler(uint32_t address, Component* c, R reader, W writer);
         const uint32_t calculate_page(const uint32_t addr);
 
+        /* The handler an access to the address is dispatched to, nullptr if there is none */
+        HandlerBase* find_handler(uint32_t paddr, bool write);
+
         /* Various loaders */
         bool load_elf(const char* filename);
 
@@ -107,6 +113,12 @@ namespace common
     protected:
         void read_bios();
 
+        /* EE cycles until the next event the EE has to see */
+        uint32_t next_timeslice(uint32_t total_cycles, bool vblank_started);
+
+        /* EE cycles the last timeslice of a frame ran past its end, they count towards the next one */
+        uint32_t frame_overshoot = 0;
+
     public:
         /* Components */
         std::unique_ptr<ee::EmotionEngine> ee;
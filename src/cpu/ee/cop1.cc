@@ -12,6 +12,11 @@ namespace ee
 		return *(float*)&value;
 	}
 
+	static inline float overflow_check(float value)
+	{
+		return overflow_check(*(uint32_t*)&value);
+	}
+
 	void COP1::execute(Instruction instr)
 	{
 		uint16_t function = instr.r_type.funct;
@@ -29,8 +34,11 @@ namespace ee
 		uint16_t fs = instr.r_type.rd;
 		uint16_t ft = instr.r_type.rt;
 
-		fmt::print("[COP1] ADDA.S: ACC = FPR[{}] ({}) + FPR[{}] ({})\n", fs, fpr[fs].fint, ft, fpr[ft].fint);
-		acc.fint = fpr[fs].fint + fpr[ft].fint;
+		float reg1 = overflow_check(fpr[fs].uint);
+		float reg2 = overflow_check(fpr[ft].uint);
+
+		fmt::print("[COP1] ADDA.S: ACC = FPR[{}] ({}) + FPR[{}] ({})\n", fs, reg1, ft, reg2);
+		acc.fint = overflow_check(reg1 + reg2);
 	}
 	
 	void COP1::op_madd(Instruction instr)
@@ -42,7 +50,8 @@ namespace ee
 		float reg1 = overflow_check(fpr[fs].uint);
 		float reg2 = overflow_check(fpr[ft].uint);
 		float accumulator = overflow_check(acc.uint);
-		fpr[fs].fint = accumulator + (reg1 * reg2);
+		/* Overflows saturate instead of producing infinities */
+		fpr[fd].fint = overflow_check(accumulator + overflow_check(reg1 * reg2));
 		
 		fmt::print("[COP1] MADD.s: ACC ({}) + GPR[{}] ({}) * GPR[{}] ({}) = {}\n", accumulator, fs, reg1, ft, reg2, fpr[fd].fint);
 	}
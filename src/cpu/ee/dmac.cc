@@ -107,6 +107,9 @@ namespace ee
 		if (channels[channel].control.running)
 		{
 			fmt::print("\n[DMAC] Transfer for channel {:d} started!\n\n", channel);
+
+			/* Let the DMAC pick the transfer up instead of waiting out the timeslice */
+			emulator->ee->end_timeslice();
 		}
 	}
 
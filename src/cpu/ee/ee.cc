@@ -5,15 +5,30 @@
 #include <cpu/ee/jit/jit.h>
 #include <fmt/color.h>
 #include <unordered_map>
+#include <cstdlib>
+#include <cstring>
 
 namespace ee
 {
     EmotionEngine::EmotionEngine(common::Emulator* parent) :
         emulator(parent), intc(this), timers(parent, &intc)
     {
-        /* Allocate the 32MB of EE memory */
-        ram = new uint8_t[32 * 1024 * 1024];
+        /* The JIT allocates the 32MB of EE memory */
         compiler = new jit::JITCompiler(this);
+        ram = compiler->fastmem.ram;
+        scratchpad = compiler->fastmem.scratchpad;
+
+        /* Keep decoded blocks around for the next boot, if asked to */
+        if (auto path = std::getenv("EE_IR_CACHE"))
+            compiler->ir_cache.open(path);
+
+        /* Profile the compiled blocks, the report goes to the file */
+        if (auto path = std::getenv("EE_JIT_PROFILE"))
+            compiler->profiler.enable(path);
+
+        /* Name JIT code for Linux perf. Before reset(), so the dispatcher is covered */
+        if (std::getenv("EE_PERF_MAP"))
+            compiler->perf_map.enable();
 
         /* Reset CPU state. */
         reset();
@@ -21,7 +36,6 @@ namespace ee
 
     EmotionEngine::~EmotionEngine()
     {
-        delete[] ram;
         delete compiler;
     }
 
@@ -47,86 +61,31 @@ namespace ee
         cop0.prid = 0x2E20;
     }
 
-    void EmotionEngine::tick(uint32_t cycles)
+    uint32_t EmotionEngine::tick(uint32_t cycles)
     {
         cycles_to_execute = cycles;
+        cycles_skipped = 0;
 
-        compiler->run();
-
-        /* Tick the cpu for the amount of cycles requested */
-        /*for (int cycle = cycles; cycle > 0; cycle--)
+        switch (backend)
         {
-            instr = next_instr;
-
-            fetch_next();
-
-            skip_branch_delay = false;
-            branch_taken = false;
-
-            switch (instr.opcode)
-            {
-            case COP0_OPCODE: op_cop0(this); break;
-            case SPECIAL_OPCODE: op_special(this); break;
-            case COP1_OPCODE: op_cop1(this); break;
-            case 0b010010: op_cop2(this); break;
-            case 0b101011: op_sw(this); break;
-            case 0b001010: op_slti(this); break;
-            case 0b000101: op_bne(this); break;
-            case 0b001101: op_ori(this); break;
-            case 0b001000: op_addi(this); break;
-            case 0b011110: op_lq(this); break;
-            case 0b001111: op_lui(this); break;
-            case 0b001001: op_addiu(this); break;
-            case 0b011100: op_mmi(this); break;
-            case 0b111111: op_sd(this); break;
-            case 0b000011: op_jal(this); break;
-            case 0b000001: op_regimm(this); break;
-            case 0b001100: op_andi(this); break;
-            case 0b000100: op_beq(this); break;
-            case 0b010100: op_beql(this); break;
-            case 0b001011: op_sltiu(this); break;
-            case 0b010101: op_bnel(this); break;
-            case 0b100000: op_lb(this); break;
-            case 0b111001: op_swc1(this); break;
-            case 0b100100: op_lbu(this); break;
-            case 0b110111: op_ld(this); break;
-            case 0b000010: op_j(this); break;
-            case 0b100011: op_lw(this); break;
-            case 0b101000: op_sb(this); break;
-            case 0b000110: op_blez(this); break;
-            case 0b000111: op_bgtz(this); break;
-            case 0b100101: op_lhu(this); break;
-            case 0b101001: op_sh(this); break;
-            case 0b001110: op_xori(this); break;
-            case 0b011001: op_daddiu(this); break;
-            case 0b011111: op_sq(this); break;
-            case 0b100001: op_lh(this); break;
-            case 0b101111: op_cache(this); break;
-            case 0b100111: op_lwu(this); break;
-            case 0b011010: op_ldl(this); break;
-            case 0b011011: op_ldr(this); break;
-            case 0b101100: op_sdl(this); break;
-            case 0b101101: op_sdr(this); break;
-            case 0b110001: op_lwc1(this); break;
-            case 0b010110: op_blezl(this); break;
-            case 0b100010: op_lwl(this); break;
-            case 0b100110: op_lwr(this); break;
-            case 0b101010: op_swl(this); break;
-            case 0b101110: op_swr(this); break;
-            case 0b111110: op_sqc2(this); break;
-            default:
-                common::Emulator::terminate("[ERROR] Unimplemented opcode: {:#06b}\n", instr.opcode & 0x3F);
-            }
+        case Backend::Interpreter:
+            interpret();
+            break;
+        default:
+            compiler->run();
+            break;
+        }
 
-            gpr[0].qword = 0;
-            cycles_to_execute--;
-        }*/
+        /* Blocks overshoot the timeslice by what's left of their cycles */
+        uint32_t executed = cycles - cycles_skipped - cycles_to_execute;
 
         /* Increment COP0 counter */
-        cop0.count += cycles + std::abs(cycles_to_execute);
+        cop0.count += executed;
 
         /* Tick the timers for BUSCLK cycles */
-        timers.tick(cycles / 2);
+        uint32_t bus_cycles = executed + odd_cycle;
+        odd_cycle = bus_cycles & 1;
+        timers.tick(bus_cycles / 2);
 
         /* Check for interrupts */
         if (intc.int_pending())
@@ -134,6 +93,141 @@ namespace ee
             fmt::print("[EE] Interrupt!\n");
             exception(Exception::Interrupt);
         }
+
+        return executed;
+    }
+
+    void EmotionEngine::end_timeslice()
+    {
+        /* Linked exits and the dispatcher check the budget after every block.
+           Nothing to cut if the timeslice is already used up */
+        if (cycles_to_execute > 0)
+        {
+            cycles_skipped += cycles_to_execute;
+            cycles_to_execute = 0;
+        }
+    }
+
+    void EmotionEngine::interpret()
+    {
+        /* The JIT leaves the PC at the next instruction, while the
+           interpreter keeps it one instruction ahead of next_instr */
+        fetch_next();
+
+        /* Never stop between a branch and its delay slot */
+        while (cycles_to_execute > 0 || next_instr.is_delay_slot)
+        {
+            step();
+            cycles_to_execute--;
+        }
+
+        pc = next_instr.pc;
+        skip_branch_delay = false;
+        branch_taken = false;
+    }
+
+    void EmotionEngine::step()
+    {
+        instr = next_instr;
+
+        fetch_next();
+
+        skip_branch_delay = false;
+        branch_taken = false;
+
+        switch (instr.opcode)
+        {
+        case COP0_OPCODE: op_cop0(this); break;
+        case SPECIAL_OPCODE: op_special(this); break;
+        case COP1_OPCODE: op_cop1(this); break;
+        case 0b010010: op_cop2(this); break;
+        case 0b101011: op_sw(this); break;
+        case 0b001010: op_slti(this); break;
+        case 0b000101: op_bne(this); break;
+        case 0b001101: op_ori(this); break;
+        case 0b001000: op_addi(this); break;
+        case 0b011110: op_lq(this); break;
+        case 0b001111: op_lui(this); break;
+        case 0b001001: op_addiu(this); break;
+        case 0b011100: op_mmi(this); break;
+        case 0b111111: op_sd(this); break;
+        case 0b000011: op_jal(this); break;
+        case 0b000001: op_regimm(this); break;
+        case 0b001100: op_andi(this); break;
+        case 0b000100: op_beq(this); break;
+        case 0b010100: op_beql(this); break;
+        case 0b001011: op_sltiu(this); break;
+        case 0b010101: op_bnel(this); break;
+        case 0b100000: op_lb(this); break;
+        case 0b111001: op_swc1(this); break;
+        case 0b100100: op_lbu(this); break;
+        case 0b110111: op_ld(this); break;
+        case 0b000010: op_j(this); break;
+        case 0b100011: op_lw(this); break;
+        case 0b101000: op_sb(this); break;
+        case 0b000110: op_blez(this); break;
+        case 0b000111: op_bgtz(this); break;
+        case 0b100101: op_lhu(this); break;
+        case 0b101001: op_sh(this); break;
+        case 0b001110: op_xori(this); break;
+        case 0b011001: op_daddiu(this); break;
+        case 0b011111: op_sq(this); break;
+        case 0b100001: op_lh(this); break;
+        case 0b101111: op_cache(this); break;
+        case 0b100111: op_lwu(this); break;
+        case 0b011010: op_ldl(this); break;
+        case 0b011011: op_ldr(this); break;
+        case 0b101100: op_sdl(this); break;
+        case 0b101101: op_sdr(this); break;
+        case 0b110001: op_lwc1(this); break;
+        case 0b010110: op_blezl(this); break;
+        case 0b100010: op_lwl(this); break;
+        case 0b100110: op_lwr(this); break;
+        case 0b101010: op_swl(this); break;
+        case 0b101110: op_swr(this); break;
+        case 0b111110: op_sqc2(this); break;
+        case 0b110110: op_lqc2(this); break;
+        default:
+            common::Emulator::terminate("[ERROR] Unimplemented opcode: {:#06b}\n", instr.opcode & 0x3F);
+        }
+
+        gpr[0].qword = 0;
+    }
+
+    uint8_t* EmotionEngine::memory_ptr(uint32_t paddr)
+    {
+        if (paddr < jit::Fastmem::RAM_SIZE)
+            return &ram[paddr];
+        else if (paddr >= 0x70000000 && paddr < 0x70004000)
+            return &scratchpad[paddr & 0x3FFF];
+
+        return nullptr;
+    }
+
+    common::HandlerBase* EmotionEngine::mmio_handler(uint32_t addr, bool write)
+    {
+        /* RAM, scratchpad and the registers of the 0x1000f000 page are handled here */
+        uint32_t paddr = addr & common::KUSEG_MASKS[addr >> 29];
+        if (memory_ptr(paddr) || (paddr & ~0xfff) == 0x1000f000)
+            return nullptr;
+
+        return emulator->find_handler(paddr, write);
+    }
+
+    bool EmotionEngine::record_write(uint32_t paddr, const void* data, size_t size)
+    {
+        MemoryWrite entry = {};
+        entry.paddr = paddr;
+        entry.size = size;
+        std::memcpy(entry.data, data, size);
+
+        /* Remember what was there, so memory writes can be rolled back */
+        uint8_t* memory = memory_ptr(paddr);
+        if (memory)
+            std::memcpy(entry.old_data, memory, size);
+
+        journal->writes.push_back(entry);
+        return memory || journal->apply_mmio;
     }
 
     void EmotionEngine::exception(Exception exception, bool log)
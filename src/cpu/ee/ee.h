@@ -89,6 +89,30 @@ namespace ee
         Trap = 13,
     };
 
+    /* How the EE executes code */
+    enum class Backend
+    {
+        JIT,
+        Interpreter,
+        /* Run every block through both and compare the results */
+        Lockstep
+    };
+
+    /* A guest memory write, recorded while a WriteJournal is attached */
+    struct MemoryWrite
+    {
+        uint32_t paddr, size;
+        uint8_t old_data[16], data[16];
+    };
+
+    struct WriteJournal
+    {
+        std::vector<MemoryWrite> writes;
+
+        /* When false, MMIO writes are only recorded and never reach the devices */
+        bool apply_mmio = true;
+    };
+
     /* A class implemeting the MIPS R5900 CPU. */
     struct EmotionEngine
     {
@@ -97,10 +121,30 @@ namespace ee
 
         /* CPU functionality. */
         void reset();
-        void tick(uint32_t cycles);
+        /* Runs the timeslice, returns the cycles that actually ran */
+        uint32_t tick(uint32_t cycles);
         void exception(Exception exception, bool log = true);
         void fetch_next();
 
+        /* Interpreter. step() runs the instruction in next_instr, interpret()
+           runs the timeslice and leaves the PC the way the JIT expects it */
+        void interpret();
+        void step();
+
+        /* Stops the timeslice after the current block, for device writes
+           that have to be seen by the rest of the system right away */
+        void end_timeslice();
+
+        /* Host pointer of EE RAM and scratchpad addresses, nullptr for anything else */
+        uint8_t* memory_ptr(uint32_t paddr);
+
+        /* The device handler read/write end up calling for the address,
+           nullptr if the access is handled some other way */
+        common::HandlerBase* mmio_handler(uint32_t addr, bool write);
+
+        /* Adds the write to the journal. Returns false if it shouldn't happen */
+        bool record_write(uint32_t paddr, const void* data, size_t size);
+
         /* Memory operations */
         template <typename T>
         T read(uint32_t addr);
@@ -123,9 +167,16 @@ namespace ee
 
         /* Used by the JIT for cycle counting */
         int cycles_to_execute = 0;
+        int cycles_skipped = 0;
 
-        /* EE memory */
-        uint8_t scratchpad[16 * 1024];
+        /* The timers run at half the EE clock, this keeps the odd cycle of a timeslice */
+        uint32_t odd_cycle = 0;
+
+        Backend backend = Backend::JIT;
+        WriteJournal* journal = nullptr;
+
+        /* EE memory. Owned by the JIT which also maps it in the fastmem window */
+        uint8_t* scratchpad = nullptr;
         uint8_t* ram = nullptr;
 
         /* MCH registers (Idk what these are) */
@@ -195,10 +246,17 @@ namespace ee
     void EmotionEngine::write(uint32_t addr, T data)
     {
         uint32_t paddr = addr & common::KUSEG_MASKS[addr >> 29];
+        if (journal && !record_write(paddr, &data, sizeof(T))) [[unlikely]]
+            return;
+
         switch (paddr)
         {
         case 0 ... 0x1ffffff:
             *(T*)&ram[paddr] = data;
+
+            /* Evict translations of the code we just overwrote */
+            if (compiler->code_pages[paddr >> jit::JITCompiler::PAGE_SHIFT]) [[unlikely]]
+                compiler->invalidate_page(paddr);
             break;
         case 0x1000f000:
         case 0x1000f010:
@@ -29,6 +29,7 @@ namespace ee
 	{
 		auto offset = (addr >> 4) & 0xf;
 		auto ptr = (uint32_t*)&regs + offset;
+		uint32_t pending = regs.intc_mask & regs.intc_stat;
 
 		/* Writing 1 to the nth bit of INTC_STAT (offset 0) clears it,
 		   while doing that to INTC_MASK (offset 1) reverses it */
@@ -37,6 +38,10 @@ namespace ee
 		/* Set appropriate COP0 status bits */
 		cpu->cop0.cause.ip0_pending = (regs.intc_mask & regs.intc_stat);
 
+		/* Unmasking a pending interrupt has to be taken right away */
+		if ((regs.intc_mask & regs.intc_stat) & ~pending)
+			cpu->end_timeslice();
+
 		fmt::print("[INTC] Writing {:#x} to {}\n", data, REGS[offset]);
 	}
 
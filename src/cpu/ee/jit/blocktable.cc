@@ -0,0 +1,53 @@
+#include <cpu/ee/jit/blocktable.h>
+
+namespace ee
+{
+	namespace jit
+	{
+        std::unique_ptr<BlockTable::Page>* BlockTable::entry(uint32_t paddr)
+        {
+            if (paddr < RAM_SIZE)
+                return &ram[paddr >> PAGE_SHIFT];
+            if (paddr - BIOS_START < BIOS_SIZE)
+                return &bios[(paddr - BIOS_START) >> PAGE_SHIFT];
+            if (paddr - SCRATCHPAD_START < SCRATCHPAD_SIZE)
+                return &scratchpad[(paddr - SCRATCHPAD_START) >> PAGE_SHIFT];
+            return nullptr;
+        }
+
+        void BlockTable::insert(uint32_t paddr, Block* block)
+        {
+            /* Code outside these regions is only found through the block cache */
+            auto page = entry(paddr);
+            if (!page)
+                return;
+
+            if (!*page)
+                *page = std::make_unique<Page>();
+
+            (**page)[(paddr & PAGE_MASK) >> 2] = block;
+        }
+
+        void BlockTable::erase(uint32_t paddr)
+        {
+            if (auto page = page_of(paddr); page)
+                (*page)[(paddr & PAGE_MASK) >> 2] = nullptr;
+        }
+
+        void BlockTable::invalidate_page(uint32_t paddr)
+        {
+            if (auto page = entry(paddr); page)
+                page->reset();
+        }
+
+        void BlockTable::clear()
+        {
+            for (auto& page : ram)
+                page.reset();
+            for (auto& page : bios)
+                page.reset();
+            for (auto& page : scratchpad)
+                page.reset();
+        }
+	}
+}
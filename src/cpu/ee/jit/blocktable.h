@@ -0,0 +1,66 @@
+#pragma once
+#include <array>
+#include <memory>
+#include <cstdint>
+
+namespace ee
+{
+	namespace jit
+	{
+        struct Block;
+
+        /* Direct mapped block lookup indexed by physical PC. The first level holds
+           a table per 4KB page, lazily allocated, with one slot per instruction.
+           RAM, BIOS and scratchpad get their own first level tables */
+        struct BlockTable
+        {
+            /* Returns the block at the physical address or nullptr if none is compiled */
+            Block* find(uint32_t paddr) const
+            {
+                auto page = page_of(paddr);
+                return page ? (*page)[(paddr & PAGE_MASK) >> 2] : nullptr;
+            }
+
+            void insert(uint32_t paddr, Block* block);
+            void erase(uint32_t paddr);
+
+            /* Forget every block on the page of the physical address */
+            void invalidate_page(uint32_t paddr);
+            void clear();
+
+            /* First level tables of RAM and BIOS, the dispatcher probes them in asm.
+               Each entry is a pointer to the page, or null if it isn't allocated */
+            const void* ram_pages() const { return ram; }
+            const void* bios_pages() const { return bios; }
+
+            static constexpr uint32_t PAGE_SHIFT = 12;
+            static constexpr uint32_t PAGE_MASK = (1 << PAGE_SHIFT) - 1;
+
+            static constexpr uint32_t RAM_SIZE = 32 * 1024 * 1024;
+            static constexpr uint32_t BIOS_START = 0x1fc00000, BIOS_SIZE = 4 * 1024 * 1024;
+            static constexpr uint32_t SCRATCHPAD_START = 0x70000000, SCRATCHPAD_SIZE = 16 * 1024;
+
+        private:
+            using Page = std::array<Block*, (1 << PAGE_SHIFT) / 4>;
+
+            /* Returns the first level entry that covers the physical address */
+            std::unique_ptr<Page>* entry(uint32_t paddr);
+            Page* page_of(uint32_t paddr) const
+            {
+                if (paddr < RAM_SIZE)
+                    return ram[paddr >> PAGE_SHIFT].get();
+                if (paddr - BIOS_START < BIOS_SIZE)
+                    return bios[(paddr - BIOS_START) >> PAGE_SHIFT].get();
+                if (paddr - SCRATCHPAD_START < SCRATCHPAD_SIZE)
+                    return scratchpad[(paddr - SCRATCHPAD_START) >> PAGE_SHIFT].get();
+                return nullptr;
+            }
+
+            std::unique_ptr<Page> ram[RAM_SIZE >> PAGE_SHIFT];
+            std::unique_ptr<Page> bios[BIOS_SIZE >> PAGE_SHIFT];
+            std::unique_ptr<Page> scratchpad[SCRATCHPAD_SIZE >> PAGE_SHIFT];
+
+            static_assert(sizeof(std::unique_ptr<Page>) == sizeof(Page*));
+        };
+	}
+}
@@ -0,0 +1,61 @@
+#include <cpu/ee/jit/codecache.h>
+#include <common/emulator.h>
+#include <algorithm>
+
+namespace ee
+{
+	namespace jit
+	{
+        /* Blocks start on a 16 byte boundary to keep the decoder happy */
+        constexpr size_t BLOCK_ALIGNMENT = 16;
+
+        CodeCache::CodeCache(size_t capacity) :
+            capacity(capacity)
+        {
+            /* Linked exits use rel32 jumps, so keep the region under 2GB */
+            void* memory = nullptr;
+            if (auto error = asmjit::VirtMem::alloc(&memory, capacity, asmjit::VirtMem::MemoryFlags::kAccessRWX); error)
+                common::Emulator::terminate("[JIT] Could not allocate {} bytes for the code cache!\n", capacity);
+
+            base = static_cast<uint8_t*>(memory);
+        }
+
+        CodeCache::~CodeCache()
+        {
+            asmjit::VirtMem::release(base, capacity);
+        }
+
+        uint8_t* CodeCache::add(asmjit::CodeHolder* code)
+        {
+            code->flatten();
+            code->resolveUnresolvedLinks();
+
+            /* Relocation can only shrink the code, so the estimate is safe to reserve */
+            size_t start = (cursor + BLOCK_ALIGNMENT - 1) & ~(BLOCK_ALIGNMENT - 1);
+            size_t estimated = code->codeSize();
+            if (start + estimated > capacity)
+                return nullptr;
+
+            uint8_t* address = base + start;
+            if (auto error = code->relocateToBase((uint64_t)address); error)
+                return nullptr;
+
+            size_t size = code->codeSize();
+            code->copyFlattenedData(address, size, asmjit::CopySectionFlags::kPadSectionBuffer);
+            asmjit::VirtMem::flushInstructionCache(address, size);
+
+            cursor = start + size;
+            peak = std::max(peak, cursor);
+            return address;
+        }
+
+        void CodeCache::flush()
+        {
+            flush_count++;
+            fmt::print("[JIT] Flushing code cache, {} of {} bytes used ({:.1f}%), flush #{}\n",
+                       cursor, capacity, stats().fill() * 100, flush_count);
+
+            cursor = 0;
+        }
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <asmjit/asmjit.h>
+#include <cstdint>
+#include <cstddef>
+
+namespace ee
+{
+	namespace jit
+	{
+        /* How the code cache has been used since startup */
+        struct CodeCacheStats
+        {
+            size_t capacity = 0, used = 0;
+
+            /* The most that was ever in use at once */
+            size_t peak = 0;
+            uint32_t flushes = 0;
+
+            float fill() const { return (float)used / capacity; }
+        };
+
+        /* A single executable region that compiled blocks are packed into.
+           Code is never freed on its own, instead the whole cache is flushed
+           once it runs out of space */
+        struct CodeCache
+        {
+            CodeCache(size_t capacity);
+            ~CodeCache();
+
+            /* Relocate and copy the emitted code in the cache.
+               Returns nullptr when there isn't enough space left */
+            uint8_t* add(asmjit::CodeHolder* code);
+
+            /* Drop everything in the cache */
+            void flush();
+
+            CodeCacheStats stats() const { return { capacity, cursor, peak, flush_count }; }
+
+        private:
+            uint8_t* base = nullptr;
+            size_t capacity = 0, cursor = 0, peak = 0;
+            uint32_t flush_count = 0;
+        };
+	}
+}
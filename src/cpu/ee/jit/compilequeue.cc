@@ -0,0 +1,114 @@
+#include <cpu/ee/jit/compilequeue.h>
+#include <chrono>
+
+namespace ee
+{
+	namespace jit
+	{
+        CompileQueue::~CompileQueue()
+        {
+            stop();
+        }
+
+        void CompileQueue::start(AssembleFunc assemble)
+        {
+            if (running())
+                return;
+
+            this->assemble = std::move(assemble);
+            stopping = false;
+            worker = std::thread(&CompileQueue::run, this);
+        }
+
+        void CompileQueue::stop()
+        {
+            if (!running())
+                return;
+
+            {
+                std::lock_guard lock(mutex);
+                stopping = true;
+            }
+
+            wake.notify_all();
+            worker.join();
+
+            /* Whatever was left is dropped along with the emitter state */
+            pending.clear();
+            busy = false;
+            ready.store(false, std::memory_order_relaxed);
+        }
+
+        uint32_t CompileQueue::push(IRBlock&& ir, BlockProfile* profile, bool optimized)
+        {
+            uint32_t id;
+            {
+                std::lock_guard lock(mutex);
+                id = next_id++;
+
+                CompileJob job;
+                job.ir = std::move(ir);
+                job.id = id;
+                job.profile = profile;
+                job.optimized = optimized;
+                pending.push_back(std::move(job));
+            }
+
+            wake.notify_one();
+            return id;
+        }
+
+        void CompileQueue::clear()
+        {
+            std::lock_guard lock(mutex);
+            pending.clear();
+        }
+
+        void CompileQueue::release()
+        {
+            {
+                std::lock_guard lock(mutex);
+                ready.store(false, std::memory_order_relaxed);
+                busy = false;
+            }
+
+            wake.notify_one();
+        }
+
+        CompileJob* CompileQueue::wait()
+        {
+            if (!running())
+                return nullptr;
+
+            std::unique_lock lock(mutex);
+            done.wait(lock, [this]() { return ready.load(std::memory_order_relaxed) || (!busy && pending.empty()); });
+            return ready.load(std::memory_order_relaxed) ? &current : nullptr;
+        }
+
+        void CompileQueue::run()
+        {
+            std::unique_lock lock(mutex);
+            while (true)
+            {
+                wake.wait(lock, [this]() { return stopping || (!busy && !pending.empty()); });
+                if (stopping)
+                    return;
+
+                current = std::move(pending.front());
+                pending.pop_front();
+                busy = true;
+                lock.unlock();
+
+                auto start = std::chrono::steady_clock::now();
+                assemble(current);
+                auto latency = std::chrono::steady_clock::now() - start;
+                current.compile_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count();
+
+                /* Publishes the emitted code along with the job */
+                lock.lock();
+                ready.store(true, std::memory_order_release);
+                done.notify_all();
+            }
+        }
+	}
+}
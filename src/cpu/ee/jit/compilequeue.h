@@ -0,0 +1,84 @@
+#pragma once
+#include <cpu/ee/jit/ir.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace ee
+{
+	namespace jit
+	{
+        struct BlockProfile;
+
+        /* A hot block on its way to native code */
+        struct CompileJob
+        {
+            IRBlock ir{ 0 };
+            uint32_t id = 0;
+            BlockProfile* profile = nullptr;
+            uint64_t compile_ns = 0;
+
+            /* The IR came from the IR cache and is optimized already */
+            bool optimized = false;
+        };
+
+        /* Compiles hot blocks on a worker thread while the emulation thread keeps
+           running them in tier 0. There is only one emitter, so it changes hands:
+           the worker optimizes and assembles a job and leaves the code in the
+           emitter until the emulation thread has installed it and called release().
+           The code cache, the block table and the links between blocks are only
+           ever touched by the emulation thread */
+        struct CompileQueue
+        {
+            using AssembleFunc = std::function<void(CompileJob&)>;
+
+            ~CompileQueue();
+
+            void start(AssembleFunc assemble);
+            void stop();
+            bool running() const { return worker.joinable(); }
+
+            /* Queue the IR of a block, returns the id of the job */
+            uint32_t push(IRBlock&& ir, BlockProfile* profile, bool optimized = false);
+
+            /* Drop the jobs the worker hasn't picked up yet */
+            void clear();
+
+            /* The assembled job waiting to be installed, if any. Polled
+               on every dispatch, so it's a single atomic load */
+            CompileJob* finished() { return ready.load(std::memory_order_acquire) ? &current : nullptr; }
+
+            /* The flag behind finished(), for the dispatcher to poll in asm */
+            const void* ready_flag() const { return &ready; }
+
+            /* Hand the emitter back to the worker after installing the finished job */
+            void release();
+
+            /* Blocks until the worker is done with the job it's on and returns it.
+               Returns nullptr once nothing is queued anymore */
+            CompileJob* wait();
+
+        private:
+            void run();
+
+            AssembleFunc assemble;
+            std::thread worker;
+            std::mutex mutex;
+            std::condition_variable wake, done;
+
+            std::deque<CompileJob> pending;
+            CompileJob current;
+            uint32_t next_id = 1;
+
+            /* busy: the worker owns the emitter, either assembling or waiting for release()
+               ready: the code of the current job can be installed */
+            bool busy = false, stopping = false;
+            std::atomic<bool> ready = false;
+            static_assert(sizeof(std::atomic<bool>) == 1);
+        };
+	}
+}
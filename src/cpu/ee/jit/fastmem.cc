@@ -0,0 +1,78 @@
+#include <cpu/ee/jit/fastmem.h>
+#include <common/emulator.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace ee
+{
+	namespace jit
+	{
+        /* The whole 32bit guest address space, plus a guard page
+           for accesses that straddle the end of it */
+        constexpr uint64_t WINDOW_SIZE = (1ull << 32) + 4096;
+
+        /* Guest segments are mirrored in 256MB steps */
+        constexpr uint64_t SEGMENT_SIZE = 0x10000000;
+
+        constexpr uint32_t HOST_PAGE_SIZE = 4096;
+
+        Fastmem::Fastmem()
+        {
+            /* RAM and the scratchpad share one file, so they can be mapped
+               multiple times and still be the same memory */
+            fd = memfd_create("ee_memory", 0);
+            if (fd < 0 || ftruncate(fd, RAM_SIZE + SCRATCHPAD_SIZE) < 0)
+                common::Emulator::terminate("[JIT] Could not create EE memory file!\n");
+
+            ram = (uint8_t*)mmap(nullptr, RAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            scratchpad = (uint8_t*)mmap(nullptr, SCRATCHPAD_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, RAM_SIZE);
+
+            base = (uint8_t*)mmap(nullptr, WINDOW_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (ram == MAP_FAILED || scratchpad == MAP_FAILED || base == MAP_FAILED)
+                common::Emulator::terminate("[JIT] Could not reserve the fastmem window!\n");
+
+            /* Mirror the memory wherever EmotionEngine::read would find it */
+            for (uint64_t vaddr = 0; vaddr < (1ull << 32); vaddr += SEGMENT_SIZE)
+            {
+                uint32_t paddr = vaddr & common::KUSEG_MASKS[vaddr >> 29];
+                if (paddr == 0)
+                {
+                    map(vaddr, RAM_SIZE, 0);
+                    ram_aliases.push_back(vaddr);
+                }
+                else if (paddr == 0x70000000)
+                {
+                    map(vaddr, SCRATCHPAD_SIZE, RAM_SIZE);
+                }
+            }
+        }
+
+        Fastmem::~Fastmem()
+        {
+            munmap(base, WINDOW_SIZE);
+            munmap(ram, RAM_SIZE);
+            munmap(scratchpad, SCRATCHPAD_SIZE);
+            close(fd);
+        }
+
+        void Fastmem::map(uint64_t vaddr, size_t size, size_t offset)
+        {
+            auto view = mmap(base + vaddr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset);
+            if (view == MAP_FAILED)
+                common::Emulator::terminate("[JIT] Could not map EE memory at {:#x} in the fastmem window!\n", vaddr);
+        }
+
+        void Fastmem::protect(uint32_t page, bool read_only)
+        {
+            int prot = read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+            for (auto vaddr : ram_aliases)
+                mprotect(base + vaddr + page * HOST_PAGE_SIZE, HOST_PAGE_SIZE, prot);
+        }
+
+        bool Fastmem::contains(const void* address) const
+        {
+            auto host = (const uint8_t*)address;
+            return host >= base && host < base + WINDOW_SIZE;
+        }
+	}
+}
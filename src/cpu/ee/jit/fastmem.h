@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace ee
+{
+	namespace jit
+	{
+        /* Backs EE RAM and the scratchpad with shared memory and mirrors them in a
+           4GB host window at every guest virtual address that reaches them, so JIT
+           blocks can access guest memory with a single mov off a base register.
+           Everything else in the window is left unmapped and faults */
+        struct Fastmem
+        {
+            Fastmem();
+            ~Fastmem();
+
+            /* Make a RAM page read only in the window, so stores to it fault */
+            void protect(uint32_t page, bool read_only);
+
+            /* Returns true if the host address lies inside the window */
+            bool contains(const void* address) const;
+
+            static constexpr size_t RAM_SIZE = 32 * 1024 * 1024;
+            static constexpr size_t SCRATCHPAD_SIZE = 16 * 1024;
+
+            /* Views used by the interpreter and DMA. Unlike the window
+               they are always writable */
+            uint8_t* ram = nullptr;
+            uint8_t* scratchpad = nullptr;
+
+            /* Host address of guest virtual address 0 */
+            uint8_t* base = nullptr;
+
+        private:
+            void map(uint64_t vaddr, size_t size, size_t offset);
+
+            int fd = -1;
+            std::vector<uint64_t> ram_aliases;
+        };
+	}
+}
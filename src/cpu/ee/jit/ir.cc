@@ -1,11 +1,41 @@
 #include <cpu/ee/jit/ir.h>
 #include <cpu/ee/ee.h>
 #include <cpu/ee/opcode.h>
+#include <algorithm>
+#include <iterator>
 
 namespace ee
 {
 	namespace jit
 	{
+        const char* operation_name(IROperation operation)
+        {
+            static const char* names[] =
+            {
+                "None", "AddWord", "AddDword", "SubWord", "SubDword", "MulWord", "MulDword", "MulAddWord",
+                "DivWord", "DivDword", "Jump", "JumpLink", "Branch", "BranchLikely", "Syscall", "ExceptionReturn",
+                "AndWord", "NorWord", "OrWord", "XorWord", "SetLessThanWord", "LogicalShiftLeftWord",
+                "LogicalShiftRightWord", "ArithmeticShiftRightWord", "LogicalShiftLeftDword",
+                "LogicalShiftRightDword", "ArithmeticShiftRightDword", "LoadByte", "LoadHalfWord",
+                "LoadWord", "LoadDword", "LoadQword", "StoreByte", "StoreHalfWord", "StoreWord",
+                "StoreDword", "StoreQword", "LoadWordLeft", "LoadWordRight", "StoreWordLeft",
+                "StoreWordRight", "LoadDwordLeft", "LoadDwordRight", "StoreDwordLeft",
+                "StoreDwordRight", "LoadUpperImmediate", "LoadFloat", "StoreFloat", "LoadQwordCop2",
+                "StoreQwordCop2", "Move", "MoveToHi",
+                "MoveToLo", "MoveToSa", "LoadConstant", "MoveFromHi", "MoveFromLo", "MoveFromSa",
+                "MoveFromCop0", "MoveToCop0", "EnableInterrupts", "DisableInterrupts", "ParallelAnd",
+                "ParallelOr", "ParallelXor", "ParallelNor", "ParallelSubByte", "ParallelSubWord",
+                "ParallelAddUnsignedSatWord", "ParallelCopyLowerDword", "ParallelCopyUpperDword",
+                "ParallelCopyHalfWord", "ParallelLeadingZeroWord", "MoveToCop1", "MoveControlToCop1",
+                "MoveControlFromCop1", "FloatAddAccumulator", "FloatMultiplyAdd", "MoveToCop2",
+                "MoveFromCop2", "MoveControlToCop2", "MoveControlFromCop2", "VectorAdd", "VectorSub",
+                "VectorSubAccumulator", "VectorMulAddAccumulator", "VectorMulSubAccumulator", "VectorMacro"
+            };
+
+            static_assert(std::size(names) == (size_t)IROperation::VectorMacro + 1);
+            return names[(int)operation];
+        }
+
         IRBlock::IRBlock(uint32_t pc) :
             pc(pc)
 		{
@@ -14,15 +44,235 @@ namespace ee
 			instructions.reserve(16);
 		}
 
-		void IRBlock::add_instruction(const IRInstruction& instr)
+		void IRBlock::add_instruction(const IRInstruction& instr, uint32_t pc)
 		{
             IRInstruction copy = instr;
             /* Remember to set the instruction PC */
-            copy.pc = pc + instructions.size() * 4;
+            copy.pc = pc;
+            end = pc + 4;
+
+            if (ranges.empty() || ranges.back().end != pc)
+                ranges.push_back(IRRange{ pc, pc });
+            ranges.back().end = end;
+
             instructions.push_back(copy);
             total_cycles += copy.instruction_cycle_count;
 		}
 
+        uint32_t IRInstruction::gpr_reads() const
+        {
+            auto bit = [](uint16_t reg) { return 1u << reg; };
+            switch (operation)
+            {
+            case IROperation::None:
+            case IROperation::Syscall:
+            case IROperation::ExceptionReturn:
+            case IROperation::EnableInterrupts:
+            case IROperation::DisableInterrupts:
+            case IROperation::LoadUpperImmediate:
+            case IROperation::MoveFromHi:
+            case IROperation::MoveFromLo:
+            case IROperation::MoveFromSa:
+            case IROperation::MoveFromCop0:
+            case IROperation::LoadConstant:
+            case IROperation::MoveControlFromCop1:
+            case IROperation::FloatAddAccumulator:
+            case IROperation::FloatMultiplyAdd:
+            case IROperation::MoveControlFromCop2:
+            case IROperation::MoveFromCop2:
+            case IROperation::VectorAdd:
+            case IROperation::VectorSub:
+            case IROperation::VectorSubAccumulator:
+            case IROperation::VectorMulAddAccumulator:
+            case IROperation::VectorMulSubAccumulator:
+            case IROperation::VectorMacro:
+                return 0;
+            case IROperation::AddWord:
+            case IROperation::AddDword:
+            case IROperation::SubWord:
+            case IROperation::SubDword:
+            case IROperation::AndWord:
+            case IROperation::OrWord:
+            case IROperation::XorWord:
+            case IROperation::NorWord:
+            case IROperation::SetLessThanWord:
+                return immediate_data ? bit(source) : bit(source) | bit(target);
+            case IROperation::LogicalShiftLeftWord:
+            case IROperation::LogicalShiftRightWord:
+            case IROperation::ArithmeticShiftRightWord:
+            case IROperation::LogicalShiftLeftDword:
+            case IROperation::LogicalShiftRightDword:
+            case IROperation::ArithmeticShiftRightDword:
+                return immediate_data ? bit(target) : bit(target) | bit(source);
+            case IROperation::Move:
+                /* The old value survives when the condition fails */
+                return bit(source) | bit(target) | bit(destination);
+            case IROperation::MulWord:
+            case IROperation::MulAddWord:
+            case IROperation::DivWord:
+                return bit(source) | bit(target);
+            case IROperation::Branch:
+            case IROperation::BranchLikely:
+                /* Only beq and bne compare two registers, the rest compare rs with zero */
+                if (condition == BranchCond::Equal || condition == BranchCond::NotEqual)
+                    return bit(source) | bit(target);
+                return bit(source);
+            case IROperation::Jump:
+            case IROperation::JumpLink:
+                return immediate_data ? 0 : bit(source);
+            case IROperation::LoadByte:
+            case IROperation::LoadHalfWord:
+            case IROperation::LoadWord:
+            case IROperation::LoadDword:
+            case IROperation::LoadQword:
+            case IROperation::LoadFloat:
+            case IROperation::StoreFloat:
+            case IROperation::LoadQwordCop2:
+            case IROperation::StoreQwordCop2:
+            case IROperation::MoveToHi:
+            case IROperation::MoveToLo:
+            case IROperation::MoveToSa:
+                return bit(source);
+            case IROperation::LoadWordLeft:
+            case IROperation::LoadWordRight:
+            case IROperation::LoadDwordLeft:
+            case IROperation::LoadDwordRight:
+            case IROperation::StoreByte:
+            case IROperation::StoreHalfWord:
+            case IROperation::StoreWord:
+            case IROperation::StoreDword:
+            case IROperation::StoreQword:
+            case IROperation::StoreWordLeft:
+            case IROperation::StoreWordRight:
+            case IROperation::StoreDwordLeft:
+            case IROperation::StoreDwordRight:
+                return bit(source) | bit(target);
+            case IROperation::MoveToCop0:
+            case IROperation::ParallelCopyHalfWord:
+            case IROperation::MoveToCop1:
+            case IROperation::MoveControlToCop1:
+            case IROperation::MoveToCop2:
+            case IROperation::MoveControlToCop2:
+                return bit(target);
+            case IROperation::ParallelLeadingZeroWord:
+                return bit(source);
+            case IROperation::ParallelAnd:
+            case IROperation::ParallelOr:
+            case IROperation::ParallelXor:
+            case IROperation::ParallelNor:
+            case IROperation::ParallelSubByte:
+            case IROperation::ParallelSubWord:
+            case IROperation::ParallelAddUnsignedSatWord:
+            case IROperation::ParallelCopyLowerDword:
+            case IROperation::ParallelCopyUpperDword:
+                return bit(source) | bit(target);
+            default:
+                return ~0u;
+            }
+        }
+
+        uint32_t IRInstruction::gpr_writes() const
+        {
+            auto bit = [](uint16_t reg) { return 1u << reg; };
+            switch (operation)
+            {
+            case IROperation::None:
+            case IROperation::Syscall:
+            case IROperation::ExceptionReturn:
+            case IROperation::EnableInterrupts:
+            case IROperation::DisableInterrupts:
+            case IROperation::DivWord:
+            case IROperation::Jump:
+            case IROperation::Branch:
+            case IROperation::BranchLikely:
+            case IROperation::LoadFloat:
+            case IROperation::StoreFloat:
+            case IROperation::StoreByte:
+            case IROperation::StoreHalfWord:
+            case IROperation::StoreWord:
+            case IROperation::StoreDword:
+            case IROperation::StoreQword:
+            case IROperation::StoreWordLeft:
+            case IROperation::StoreWordRight:
+            case IROperation::StoreDwordLeft:
+            case IROperation::StoreDwordRight:
+            case IROperation::MoveToHi:
+            case IROperation::MoveToLo:
+            case IROperation::MoveToSa:
+            case IROperation::MoveToCop0:
+            case IROperation::MoveToCop1:
+            case IROperation::MoveControlToCop1:
+            case IROperation::FloatAddAccumulator:
+            case IROperation::FloatMultiplyAdd:
+            case IROperation::LoadQwordCop2:
+            case IROperation::StoreQwordCop2:
+            case IROperation::MoveToCop2:
+            case IROperation::MoveControlToCop2:
+            case IROperation::VectorAdd:
+            case IROperation::VectorSub:
+            case IROperation::VectorSubAccumulator:
+            case IROperation::VectorMulAddAccumulator:
+            case IROperation::VectorMulSubAccumulator:
+            case IROperation::VectorMacro:
+                return 0;
+            case IROperation::AddWord:
+            case IROperation::AddDword:
+            case IROperation::SubWord:
+            case IROperation::SubDword:
+            case IROperation::AndWord:
+            case IROperation::OrWord:
+            case IROperation::XorWord:
+            case IROperation::NorWord:
+            case IROperation::SetLessThanWord:
+                return immediate_data ? bit(target) : bit(destination);
+            case IROperation::LogicalShiftLeftWord:
+            case IROperation::LogicalShiftRightWord:
+            case IROperation::ArithmeticShiftRightWord:
+            case IROperation::LogicalShiftLeftDword:
+            case IROperation::LogicalShiftRightDword:
+            case IROperation::ArithmeticShiftRightDword:
+            case IROperation::Move:
+            case IROperation::MulWord:
+            case IROperation::MulAddWord:
+            case IROperation::MoveFromHi:
+            case IROperation::MoveFromLo:
+            case IROperation::MoveFromSa:
+            case IROperation::ParallelAnd:
+            case IROperation::ParallelOr:
+            case IROperation::ParallelXor:
+            case IROperation::ParallelNor:
+            case IROperation::ParallelSubByte:
+            case IROperation::ParallelSubWord:
+            case IROperation::ParallelAddUnsignedSatWord:
+            case IROperation::ParallelCopyLowerDword:
+            case IROperation::ParallelCopyUpperDword:
+            case IROperation::ParallelCopyHalfWord:
+            case IROperation::ParallelLeadingZeroWord:
+                return bit(destination);
+            case IROperation::JumpLink:
+                /* JAL always links to $ra */
+                return immediate_data ? bit(31) : bit(destination);
+            case IROperation::LoadUpperImmediate:
+            case IROperation::LoadConstant:
+            case IROperation::LoadByte:
+            case IROperation::LoadHalfWord:
+            case IROperation::LoadWord:
+            case IROperation::LoadDword:
+            case IROperation::LoadQword:
+            case IROperation::LoadWordLeft:
+            case IROperation::LoadWordRight:
+            case IROperation::LoadDwordLeft:
+            case IROperation::LoadDwordRight:
+            case IROperation::MoveFromCop0:
+            case IROperation::MoveControlFromCop1:
+            case IROperation::MoveFromCop2:
+            case IROperation::MoveControlFromCop2:
+                return bit(target);
+            default:
+                return ~0u;
+            }
+        }
+
 		IRBuilder::IRBuilder(EmotionEngine* parent) :
 			ee(parent)
 		{
@@ -32,24 +282,149 @@ namespace ee
 		{
             IRBlock block(pc);
 
-            /* Add decoded instructions in the block until a jump */
+            /* Add decoded instructions in the block until a jump. Direct jumps
+               are followed into their target, so call chains form a single block */
             bool branch_delay = false;
             do
             {
                 uint32_t value = ee->read<uint32_t>(pc);
-                pc += 4;
 
                 auto instr = decode(value);
                 instr.cycles_till_now = block.total_cycles;
-                block.add_instruction(instr);
+                block.add_instruction(instr, pc);
+                pc += 4;
 
                 branch_delay = block.size() > 1 ? (block[block.size() - 2].is_branch || block[block.size() - 1].is_direct)
                                                 : false;
+                if (branch_delay && follow_jump(block, pc))
+                    branch_delay = false;
             } while (!branch_delay);
 
+            block.idle_loop = is_idle_loop(block);
 			return block;
 		}
 
+        /* What is left of a jal once the builder follows it */
+        static void op_link(EmotionEngine* ee)
+        {
+            ee->gpr[31].dword[0] = ee->instr.pc + 8;
+        }
+
+        bool IRBuilder::follow_jump(IRBlock& block, uint32_t& target)
+        {
+            if (block.size() < 2 || block.size() >= MAX_BLOCK_SIZE)
+                return false;
+
+            /* Only j and jal know their target. The delay slot has already been added */
+            auto& jump = block[block.size() - 2];
+            if (!jump.immediate_data || block[block.size() - 1].is_branch ||
+                (jump.operation != IROperation::Jump && jump.operation != IROperation::JumpLink))
+                return false;
+
+            /* Jumps back into the block stay branches, so loops are still linked and detected as idle */
+            uint32_t destination = ((jump.pc + 4) & 0xF0000000) | (jump.immediate << 2);
+            for (auto& range : block.ranges)
+            {
+                if (destination >= range.pc && destination < range.end)
+                    return false;
+            }
+
+            /* The jump itself runs inline now. A jal still has to link,
+               zero extended the same way the interpreter does it */
+            if (jump.operation == IROperation::JumpLink)
+            {
+                jump.operation = IROperation::LoadConstant;
+                jump.target = 31;
+                jump.immediate = jump.pc + 8;
+                jump.signed_data = false;
+                jump.handler = op_link;
+            }
+            else
+            {
+                jump.operation = IROperation::None;
+                jump.handler = nullptr;
+            }
+
+            jump.is_branch = false;
+            target = destination;
+            return true;
+        }
+
+        bool IRBuilder::is_idle_loop(IRBlock& block)
+        {
+            /* Look for a branch back to the start of the block */
+            auto branch = std::find_if(block.instructions.rbegin(), block.instructions.rend(),
+                                       [](const IRInstruction& instr) { return instr.is_branch; });
+            if (branch == block.instructions.rend())
+                return false;
+
+            uint32_t target = 0;
+            switch (branch->operation)
+            {
+            case IROperation::Branch:
+            case IROperation::BranchLikely:
+                target = branch->pc + 4 + ((int16_t)branch->immediate << 2);
+                break;
+            case IROperation::Jump:
+                if (!branch->immediate_data)
+                    return false;
+                target = ((branch->pc + 4) & 0xF0000000) | (branch->immediate << 2);
+                break;
+            default:
+                return false;
+            }
+
+            if (target != block.pc)
+                return false;
+
+            /* Only loads and plain computations are allowed. Anything that
+               stores or talks to the rest of the system might make progress */
+            uint32_t written = 0, live_in = 0;
+            for (auto& instr : block.instructions)
+            {
+                switch (instr.operation)
+                {
+                case IROperation::None:
+                case IROperation::AddWord:
+                case IROperation::AddDword:
+                case IROperation::SubWord:
+                case IROperation::SubDword:
+                case IROperation::AndWord:
+                case IROperation::OrWord:
+                case IROperation::XorWord:
+                case IROperation::NorWord:
+                case IROperation::SetLessThanWord:
+                case IROperation::LogicalShiftLeftWord:
+                case IROperation::LogicalShiftRightWord:
+                case IROperation::ArithmeticShiftRightWord:
+                case IROperation::LogicalShiftLeftDword:
+                case IROperation::LogicalShiftRightDword:
+                case IROperation::ArithmeticShiftRightDword:
+                case IROperation::LoadUpperImmediate:
+                case IROperation::Move:
+                case IROperation::LoadByte:
+                case IROperation::LoadHalfWord:
+                case IROperation::LoadWord:
+                case IROperation::LoadDword:
+                case IROperation::LoadQword:
+                case IROperation::Branch:
+                case IROperation::BranchLikely:
+                case IROperation::Jump:
+                    break;
+                default:
+                    return false;
+                }
+
+                live_in |= instr.gpr_reads() & ~written;
+                written |= instr.gpr_writes();
+            }
+
+            /* A register carried over from the previous iteration means the loop
+               computes something, like a delay loop counting down. Otherwise every
+               iteration sees the same memory and takes the same path */
+            return (live_in & written & ~1u) == 0;
+        }
+
         IRInstruction IRBuilder::decode(uint32_t value)
         {
             Instruction instr{.value = value};
@@ -133,6 +508,7 @@ namespace ee
                 {
                 case 0b000000:
                     ir_instr.operation = value == 0 ? IROperation::None : IROperation::LogicalShiftLeftWord;
+                    ir_instr.immediate_data = true;
                     ir_instr.handler = op_sll;
                     break;
                 case 0b001000:
@@ -334,29 +710,95 @@ namespace ee
                 uint32_t fmt = (instr.value >> 21) & 0x1f;
                 switch (fmt)
                 {
-                //case 0b00100: op_mtc1(ee); break;
-                //case 0b00110: op_ctc1(ee); break;
-                //case 0b00010: op_cfc1(ee); break;
-                //case 0b10000: ee->cop1.execute(ee->instr); break;
-                default:
-                    //common::Emulator::terminate("[ERROR] Unimplemented COP1 instruction {:#07b}\n", fmt);
-                    ir_instr.operation = IROperation::None;
+                case 0b00100:
+                    ir_instr.operation = IROperation::MoveToCop1;
+                    ir_instr.handler = op_mtc1;
+                    break;
+                case 0b00110:
+                    ir_instr.operation = IROperation::MoveControlToCop1;
+                    ir_instr.handler = op_ctc1;
+                    break;
+                case 0b00010:
+                {
+                    /* Only FCR0 and FCR31 exist, the others read as zero */
+                    uint32_t fs = instr.r_type.rd;
+                    ir_instr.operation = IROperation::MoveControlFromCop1;
+                    ir_instr.handler = op_cfc1;
+                    if (fs != 0 && fs != 31)
+                    {
+                        ir_instr.operation = IROperation::LoadConstant;
+                        ir_instr.immediate = 0;
+                        ir_instr.immediate_data = true;
+                        ir_instr.signed_data = true;
+                    }
                     break;
                 }
+                case 0b10000:
+                {
+                    /* Single precision operations, the handler goes through COP1::execute */
+                    ir_instr.handler = op_cop1;
+                    switch (instr.r_type.funct)
+                    {
+                    case 0b011000:
+                        ir_instr.operation = IROperation::FloatAddAccumulator;
+                        break;
+                    case 0b011100:
+                        ir_instr.operation = IROperation::FloatMultiplyAdd;
+                        break;
+                    default:
+                        common::Emulator::terminate("[JIT] Failed to decode COP1 instruction: {:#08b}\n", (uint32_t)instr.r_type.funct);
+                    }
+                    break;
+                }
+                default:
+                    common::Emulator::terminate("[JIT] Failed to decode COP1 instruction {:#07b}\n", fmt);
+                }
                 break;
             }
             case 0b010010:
             {
                 uint32_t fmt = (instr.value >> 21) & 0x1f;
+                ir_instr.handler = op_cop2;
                 switch (fmt)
                 {
                 case 0b00010:
+                    ir_instr.operation = IROperation::MoveControlFromCop2;
+                    break;
                 case 0b00110:
+                    ir_instr.operation = IROperation::MoveControlToCop2;
+                    break;
                 case 0b00001:
+                    ir_instr.operation = IROperation::MoveFromCop2;
+                    break;
                 case 0b00101:
+                    ir_instr.operation = IROperation::MoveToCop2;
+                    break;
                 case 0b10000 ... 0b11111:
-                    ir_instr.operation = IROperation::None;
+                {
+                    /* Macro operations the JIT doesn't emit itself go through VectorUnit::special1 */
+                    ir_instr.operation = IROperation::VectorMacro;
+                    switch (instr.value & 0x3f)
+                    {
+                    case 0b101000:
+                        ir_instr.operation = IROperation::VectorAdd;
+                        break;
+                    case 0b101100:
+                        ir_instr.operation = IROperation::VectorSub;
+                        break;
+                    case 0b111100 ... 0b111111:
+                    {
+                        uint32_t opcode = (instr.value & 0x3) | ((instr.value >> 6) & 0x1f) * 4;
+                        switch (opcode)
+                        {
+                        case 0b0000100: ir_instr.operation = IROperation::VectorSubAccumulator; break;
+                        case 0b0001000: ir_instr.operation = IROperation::VectorMulAddAccumulator; break;
+                        case 0b0001100: ir_instr.operation = IROperation::VectorMulSubAccumulator; break;
+                        }
+                        break;
+                    }
+                    }
                     break;
+                }
                 default:
                     common::Emulator::terminate("[ERROR] Unimplemented COP2 instruction {:#07b}\n", fmt);
                 }
@@ -368,39 +810,49 @@ namespace ee
                 switch (type)
                 {
                 case 0b100000:
-                    ir_instr.operation = IROperation::AddDword;
+                    ir_instr.operation = IROperation::MulAddWord;
+                    ir_instr.signed_data = true;
+                    ir_instr.pipeline = 1;
                     ir_instr.handler = op_madd1;
                     break;
                 case 0b000000:
-                    ir_instr.operation = IROperation::AddDword;
+                    ir_instr.operation = IROperation::MulAddWord;
+                    ir_instr.signed_data = true;
                     ir_instr.handler = op_madd;
                     break;
                 case 0b011011:
                     ir_instr.operation = IROperation::DivWord;
+                    ir_instr.pipeline = 1;
                     ir_instr.handler = op_divu1;
                     break;
                 case 0b010010:
                     ir_instr.operation = IROperation::MoveFromLo;
+                    ir_instr.pipeline = 1;
                     ir_instr.handler = op_mflo1;
                     break;
                 case 0b011000:
-                    ir_instr.operation = IROperation::MulDword;
+                    ir_instr.operation = IROperation::MulWord;
+                    ir_instr.signed_data = true;
+                    ir_instr.pipeline = 1;
                     ir_instr.handler = op_mult1;
                     break;
                 case 0b000100:
-                    ir_instr.operation = IROperation::MulDword;
+                    ir_instr.operation = IROperation::ParallelLeadingZeroWord;
                     ir_instr.handler = op_plzcw;
                     break;
                 case 0b010000:
-                    ir_instr.operation = IROperation::MulDword;
+                    ir_instr.operation = IROperation::MoveFromHi;
+                    ir_instr.pipeline = 1;
                     ir_instr.handler = op_mfhi1;
                     break;
                 case 0b010001:
-                    ir_instr.operation = IROperation::MulDword;
+                    ir_instr.operation = IROperation::MoveToHi;
+                    ir_instr.pipeline = 1;
                     ir_instr.handler = op_mthi1;
                     break;
                 case 0b010011:
-                    ir_instr.operation = IROperation::MulDword;
+                    ir_instr.operation = IROperation::MoveToLo;
+                    ir_instr.pipeline = 1;
                     ir_instr.handler = op_mtlo1;
                     break;
                 case 0b101001:
@@ -408,19 +860,19 @@ namespace ee
                     switch (instr.r_type.sa)
                     {
                     case 0b10010:
-                        ir_instr.operation = IROperation::MulDword;
+                        ir_instr.operation = IROperation::ParallelOr;
                         ir_instr.handler = op_por;
                         break;
                     case 0b11011:
-                        ir_instr.operation = IROperation::MulDword;
+                        ir_instr.operation = IROperation::ParallelCopyHalfWord;
                         ir_instr.handler = op_pcpyh;
                         break;
                     case 0b10011:
-                        ir_instr.operation = IROperation::MulDword;
+                        ir_instr.operation = IROperation::ParallelNor;
                         ir_instr.handler = op_pnor;
                         break;
                     case 0b01110:
-                        ir_instr.operation = IROperation::MulDword;
+                        ir_instr.operation = IROperation::ParallelCopyUpperDword;
                         ir_instr.handler = op_pcpyud;
                         break;
                     default:
@@ -433,11 +885,11 @@ namespace ee
                     switch (instr.r_type.sa)
                     {
                     case 0b01001:
-                        ir_instr.operation = IROperation::MulDword;
+                        ir_instr.operation = IROperation::ParallelSubByte;
                         ir_instr.handler = op_psubb;
                         break;
                     case 0b00001:
-                        ir_instr.operation = IROperation::MulDword;
+                        ir_instr.operation = IROperation::ParallelSubWord;
                         ir_instr.handler = op_psubw;
                         break;
                     default:
@@ -450,7 +902,7 @@ namespace ee
                     switch (instr.r_type.sa)
                     {
                     case 0b10000:
-                        ir_instr.operation = IROperation::MulDword;
+                        ir_instr.operation = IROperation::ParallelAddUnsignedSatWord;
                         ir_instr.handler = op_padduw;
                         break;
                     default:
@@ -458,6 +910,27 @@ namespace ee
                     }
                     break;
                 }
+                case 0b001001:
+                {
+                    switch (instr.r_type.sa)
+                    {
+                    case 0b01110:
+                        ir_instr.operation = IROperation::ParallelCopyLowerDword;
+                        ir_instr.handler = op_pcpyld;
+                        break;
+                    case 0b10010:
+                        ir_instr.operation = IROperation::ParallelAnd;
+                        ir_instr.handler = op_pand;
+                        break;
+                    case 0b10011:
+                        ir_instr.operation = IROperation::ParallelXor;
+                        ir_instr.handler = op_pxor;
+                        break;
+                    default:
+                        common::Emulator::terminate("[ERROR] Unimplemented MMI2 instruction: {:#07b}\n", (uint16_t)instr.r_type.sa);
+                    }
+                    break;
+                }
                 default:
                     common::Emulator::terminate("[JIT] Failed to decode MMI instruction: {:#06b}\n", type);
                 }
@@ -703,6 +1176,14 @@ namespace ee
                 ir_instr.operation = IROperation::StoreWordRight;
                 ir_instr.handler = op_swr;
                 break;
+            case 0b110110:
+                ir_instr.operation = IROperation::LoadQwordCop2;
+                ir_instr.handler = op_lqc2;
+                break;
+            case 0b111110:
+                ir_instr.operation = IROperation::StoreQwordCop2;
+                ir_instr.handler = op_sqc2;
+                break;
             default:
                 common::Emulator::terminate("[JIT] Failed to decode opcode: {:#06b}\n", instr.opcode & 0x3F);
             }
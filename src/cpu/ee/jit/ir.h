@@ -26,7 +26,7 @@ namespace ee
 
             /* Arithemetic */
             AddWord, AddDword, SubWord, SubDword,
-            MulWord, MulDword, DivWord, DivDword,
+            MulWord, MulDword, MulAddWord, DivWord, DivDword,
 
             /* Branch */
             Jump, JumpLink,
@@ -50,16 +50,37 @@ namespace ee
             LoadDwordLeft, LoadDwordRight, StoreDwordLeft, StoreDwordRight,
             LoadUpperImmediate,
             LoadFloat, StoreFloat,
+            LoadQwordCop2, StoreQwordCop2,
 
             /* Move */
             Move, MoveToHi, MoveToLo, MoveToSa,
+            LoadConstant,
             MoveFromHi, MoveFromLo, MoveFromSa,
             MoveFromCop0, MoveToCop0,
 
             /* Interrupts */
-            EnableInterrupts, DisableInterrupts
+            EnableInterrupts, DisableInterrupts,
+
+            /* Parallel (MMI) operations on the full 128bit GPRs */
+            ParallelAnd, ParallelOr, ParallelXor, ParallelNor,
+            ParallelSubByte, ParallelSubWord, ParallelAddUnsignedSatWord,
+            ParallelCopyLowerDword, ParallelCopyUpperDword, ParallelCopyHalfWord,
+            ParallelLeadingZeroWord,
+
+            /* Floating point (COP1) */
+            MoveToCop1, MoveControlToCop1, MoveControlFromCop1,
+            FloatAddAccumulator, FloatMultiplyAdd,
+
+            /* VU0 macro mode (COP2) */
+            MoveToCop2, MoveFromCop2, MoveControlToCop2, MoveControlFromCop2,
+            VectorAdd, VectorSub, VectorSubAccumulator,
+            VectorMulAddAccumulator, VectorMulSubAccumulator,
+            VectorMacro
         };
 
+        /* Name of the operation, for debug output */
+        const char* operation_name(IROperation operation);
+
         using InterpreterFunc = void (*)(EmotionEngine*);
 
         /* Instruction representation consumable from CodeGenerator */
@@ -79,25 +100,57 @@ namespace ee
             bool is_branch = false, is_likely_branch = false;
             bool is_direct = false;
 
+            /* MULT/DIV and the HI/LO moves of the second MMI pipeline use hi1/lo1 */
+            uint8_t pipeline = 0;
+
+            /* Set by the optimizer when the base register of a load/store is known */
+            bool constant_address = false;
+            uint32_t address = 0;
+
             /* Keep track of the cycles between instructions */
             uint32_t cycles_till_now, instruction_cycle_count;
 
             /* Interpreter fallback */
             void (*handler)(EmotionEngine*) = nullptr;
             uint32_t pc, value;
+
+            /* Bitmasks of the guest GPRs the instruction reads and writes.
+               Unknown instructions conservatively report every register */
+            uint32_t gpr_reads() const;
+            uint32_t gpr_writes() const;
 		};
 
+        /* Contiguous run of guest code [pc, end) */
+        struct IRRange
+        {
+            uint32_t pc, end;
+        };
+
         /* Thin wrapper around a linear stream of instructions */
         struct IRBlock
         {
             IRBlock(uint32_t pc);
             ~IRBlock() = default;
 
-            void add_instruction(const IRInstruction& instr);
+            /* Appends the instruction at the PC. Starts a new range
+               when it doesn't directly follow the previous one */
+            void add_instruction(const IRInstruction& instr, uint32_t pc);
             int size() const { return instructions.size(); }
             IRInstruction& operator[](int offset) { return instructions[offset]; }
 
             uint32_t total_cycles = 0, pc = 0;
+
+            /* Address right after the last guest instruction.
+               Stays put when the optimizer removes instructions */
+            uint32_t end = 0;
+
+            /* The guest code the block was decoded from, in execution order.
+               Superblocks that followed jumps have more than one */
+            std::vector<IRRange> ranges;
+
+            /* Set when the block branches back to itself without changing any state,
+               so it will keep spinning until something outside of the EE runs */
+            bool idle_loop = false;
             std::vector<IRInstruction> instructions;
         };
 
@@ -112,8 +165,13 @@ namespace ee
                at the given PC */
             IRBlock generate(uint32_t pc);
 
+            /* Superblocks stop growing at this many instructions */
+            static constexpr int MAX_BLOCK_SIZE = 256;
+
         private:
             IRInstruction decode(uint32_t value);
+            static bool follow_jump(IRBlock& block, uint32_t& target);
+            static bool is_idle_loop(IRBlock& block);
 
         private:
             EmotionEngine* ee;
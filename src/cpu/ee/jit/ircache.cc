@@ -0,0 +1,349 @@
+#include <cpu/ee/jit/ircache.h>
+#include <cpu/ee/ee.h>
+#include <common/emulator.h>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ee
+{
+	namespace jit
+	{
+        constexpr uint32_t MAGIC = 0x52494545; /* EEIR */
+
+        struct FileHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t fingerprint;
+        };
+
+        /* Followed by the instructions, the offsets of their handlers and the guest ranges */
+        struct RecordHeader
+        {
+            uint32_t pc, end;
+            uint32_t total_cycles, count;
+            uint64_t hash;
+            uint32_t idle_loop, range_count;
+        };
+
+        /* Interpreter handlers move around between runs, but not relative
+           to each other. Store them as offsets from this function */
+        static void anchor() {}
+
+        static int64_t handler_offset(InterpreterFunc handler)
+        {
+            if (!handler)
+                return 0;
+
+            return reinterpret_cast<intptr_t>(handler) - reinterpret_cast<intptr_t>(&anchor);
+        }
+
+        static InterpreterFunc handler_from_offset(int64_t offset)
+        {
+            if (!offset)
+                return nullptr;
+
+            return reinterpret_cast<InterpreterFunc>(reinterpret_cast<intptr_t>(&anchor) + offset);
+        }
+
+        static uint64_t fnv1a(uint64_t hash, uint64_t value)
+        {
+            for (int i = 0; i < 8; i++)
+            {
+                hash ^= (value >> (i * 8)) & 0xff;
+                hash *= 0x100000001b3;
+            }
+
+            return hash;
+        }
+
+        /* Identifies the build that wrote the file. Handler offsets are only meaningful
+           for the exact same executable, so the whole of it is hashed. Zero if it can't be read */
+        static uint64_t build_fingerprint()
+        {
+            static const uint64_t fingerprint = []() -> uint64_t
+            {
+                int fd = ::open("/proc/self/exe", O_RDONLY);
+                if (fd < 0)
+                    return 0;
+
+                struct stat info;
+                void* exe = MAP_FAILED;
+                if (fstat(fd, &info) == 0 && info.st_size > 0)
+                    exe = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                close(fd);
+
+                if (exe == MAP_FAILED)
+                    return 0;
+
+                uint64_t hash = fnv1a(0xcbf29ce484222325, IRCache::VERSION);
+                hash = fnv1a(hash, sizeof(IRInstruction));
+
+                auto bytes = static_cast<const uint8_t*>(exe);
+                size_t size = info.st_size, offset = 0;
+                for (; offset + sizeof(uint64_t) <= size; offset += sizeof(uint64_t))
+                {
+                    uint64_t word;
+                    std::memcpy(&word, bytes + offset, sizeof(word));
+                    hash = fnv1a(hash, word);
+                }
+
+                for (; offset < size; offset++)
+                    hash = fnv1a(hash, bytes[offset]);
+
+                munmap(exe, size);
+                return hash ? hash : 1;
+            }();
+
+            return fingerprint;
+        }
+
+        /* Holds the lock file while reading or writing the cache */
+        struct CacheLock
+        {
+            CacheLock(int fd) : fd(fd)
+            {
+                if (fd >= 0)
+                    flock(fd, LOCK_EX);
+            }
+
+            ~CacheLock()
+            {
+                if (fd >= 0)
+                    flock(fd, LOCK_UN);
+            }
+
+            int fd;
+        };
+
+        static size_t record_size(const RecordHeader* record)
+        {
+            return sizeof(RecordHeader) + record->count * (sizeof(IRInstruction) + sizeof(int64_t)) +
+                   record->range_count * sizeof(IRRange);
+        }
+
+        IRCache::~IRCache()
+        {
+            flush();
+
+            if (writer)
+                fclose(writer);
+
+            if (view)
+                munmap(view, view_size);
+
+            if (lock_fd >= 0)
+                close(lock_fd);
+        }
+
+        void IRCache::open(const std::string& path)
+        {
+            this->path = path;
+            enabled = true;
+        }
+
+        uint64_t IRCache::hash_code(EmotionEngine* ee, const IRRange* ranges, uint32_t count)
+        {
+            uint64_t hash = 0xcbf29ce484222325;
+            for (uint32_t i = 0; i < count; i++)
+            {
+                hash = fnv1a(hash, ranges[i].pc);
+                for (uint32_t addr = ranges[i].pc; addr < ranges[i].end; addr += 4)
+                    hash = fnv1a(hash, ee->read<uint32_t>(addr));
+            }
+
+            return hash;
+        }
+
+        void IRCache::load()
+        {
+            loaded = true;
+
+            /* Without knowing the build the records can't be trusted at all */
+            if (!build_fingerprint())
+            {
+                fmt::print("[JIT] Could not fingerprint the executable, IR cache {} disabled\n", path);
+                enabled = false;
+                return;
+            }
+
+            lock_fd = ::open((path + ".lock").c_str(), O_RDWR | O_CREAT, 0644);
+            if (lock_fd < 0)
+                fmt::print("[JIT] Could not open the lock file of IR cache {}\n", path);
+
+            CacheLock lock(lock_fd);
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd >= 0)
+            {
+                struct stat info;
+                if (fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(FileHeader))
+                {
+                    view_size = info.st_size;
+                    view = (uint8_t*)mmap(nullptr, view_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (view == MAP_FAILED)
+                        view = nullptr;
+                }
+
+                close(fd);
+            }
+
+            FileHeader header = {};
+            if (view)
+                std::memcpy(&header, view, sizeof(header));
+
+            /* A file from another build can't be trusted, start a new one */
+            if (header.magic != MAGIC || header.version != VERSION ||
+                header.fingerprint != build_fingerprint())
+            {
+                if (view)
+                {
+                    fmt::print("[JIT] IR cache {} is from a different build, discarding it\n", path);
+                    munmap(view, view_size);
+                    view = nullptr;
+                }
+
+                /* Replace the file rather than truncating it, another
+                   emulator might still have the old one mapped */
+                header = { MAGIC, VERSION, build_fingerprint() };
+                std::string temp = fmt::format("{}.{}", path, getpid());
+                if (FILE* file = fopen(temp.c_str(), "wb"))
+                {
+                    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+                    if (fclose(file) == 0 && written && rename(temp.c_str(), path.c_str()) == 0)
+                        writer = fopen(path.c_str(), "ab");
+                    else
+                        unlink(temp.c_str());
+                }
+            }
+            else
+            {
+                /* Index the complete records. A crash might have left a partial one at the end */
+                size_t offset = sizeof(FileHeader);
+                while (offset + sizeof(RecordHeader) <= view_size)
+                {
+                    auto record = (const RecordHeader*)(view + offset);
+                    if (offset + record_size(record) > view_size)
+                        break;
+
+                    index[record->pc].push_back(offset);
+                    stored.insert(record->hash ^ record->pc);
+                    offset += record_size(record);
+                }
+
+                fmt::print("[JIT] Loaded {} blocks from IR cache {}\n", stored.size(), path);
+
+                /* Records are only appended under the lock, so anything after
+                   the last complete one was left by a crash */
+                if (offset == view_size || truncate(path.c_str(), offset) == 0)
+                    writer = fopen(path.c_str(), "ab");
+            }
+
+            if (!writer)
+                fmt::print("[JIT] Could not open IR cache {} for writing\n", path);
+        }
+
+        bool IRCache::lookup(EmotionEngine* ee, uint32_t pc, IRBlock& block)
+        {
+            if (!enabled)
+                return false;
+
+            if (!loaded)
+                load();
+
+            auto result = index.find(pc);
+            if (result == index.end())
+                return false;
+
+            for (auto offset : result->second)
+            {
+                auto record = (const RecordHeader*)(view + offset);
+                auto instructions = view + offset + sizeof(RecordHeader);
+                auto handlers = instructions + record->count * sizeof(IRInstruction);
+
+                std::vector<IRRange> ranges(record->range_count);
+                std::memcpy(ranges.data(), handlers + record->count * sizeof(int64_t), ranges.size() * sizeof(IRRange));
+                if (hash_code(ee, ranges.data(), ranges.size()) != record->hash)
+                    continue;
+
+                block.pc = record->pc;
+                block.end = record->end;
+                block.ranges = std::move(ranges);
+                block.total_cycles = record->total_cycles;
+                block.idle_loop = record->idle_loop;
+                block.instructions.resize(record->count);
+                for (uint32_t i = 0; i < record->count; i++)
+                {
+                    int64_t handler;
+                    std::memcpy(&block.instructions[i], instructions + i * sizeof(IRInstruction), sizeof(IRInstruction));
+                    std::memcpy(&handler, handlers + i * sizeof(int64_t), sizeof(int64_t));
+                    block.instructions[i].handler = handler_from_offset(handler);
+                }
+
+                return true;
+            }
+
+            return false;
+        }
+
+        void IRCache::store(EmotionEngine* ee, const IRBlock& block)
+        {
+            if (!enabled)
+                return;
+
+            if (!loaded)
+                load();
+
+            /* Blocks get rebuilt after a flush, they only need to be written once */
+            uint64_t hash = hash_code(ee, block.ranges.data(), block.ranges.size());
+            if (!writer || !stored.insert(hash ^ block.pc).second)
+                return;
+
+            auto append = [this](const void* data, size_t size)
+            {
+                auto bytes = static_cast<const uint8_t*>(data);
+                pending.insert(pending.end(), bytes, bytes + size);
+            };
+
+            RecordHeader record = {};
+            record.pc = block.pc;
+            record.end = block.end;
+            record.total_cycles = block.total_cycles;
+            record.count = block.instructions.size();
+            record.hash = hash;
+            record.idle_loop = block.idle_loop;
+            record.range_count = block.ranges.size();
+            append(&record, sizeof(record));
+
+            /* Never write host pointers to disk */
+            std::vector<int64_t> handlers;
+            for (auto instr : block.instructions)
+            {
+                handlers.push_back(handler_offset(instr.handler));
+                instr.handler = nullptr;
+                append(&instr, sizeof(instr));
+            }
+
+            append(handlers.data(), handlers.size() * sizeof(int64_t));
+            append(block.ranges.data(), block.ranges.size() * sizeof(IRRange));
+
+            if (pending.size() >= FLUSH_SIZE)
+                flush();
+        }
+
+        void IRCache::flush()
+        {
+            if (!writer || pending.empty())
+                return;
+
+            /* Whole batches go out under the lock, so records of different emulators never interleave */
+            CacheLock lock(lock_fd);
+            fwrite(pending.data(), 1, pending.size(), writer);
+            fflush(writer);
+            pending.clear();
+        }
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cpu/ee/jit/ir.h>
+#include <robin_hood.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace ee
+{
+	namespace jit
+	{
+        /* Keeps optimized IR blocks on disk so later runs can skip decoding.
+           Blocks are keyed by their PC and a hash of the guest instructions they
+           were built from, so code that changed in the meantime is just a miss.
+           The file is an append only log that gets memory mapped on first use.
+           Several emulators can share it, they take turns through a lock file */
+        struct IRCache
+        {
+            IRCache() = default;
+            ~IRCache();
+
+            /* Enable the cache, backed by the file at the path. Nothing is read until the first lookup */
+            void open(const std::string& path);
+
+            /* Fill the block from the cache if the code at the PC hasn't changed since it was stored */
+            bool lookup(EmotionEngine* ee, uint32_t pc, IRBlock& block);
+
+            /* Remember a freshly built block for the next run. Records are
+               batched and written out once enough of them pile up */
+            void store(EmotionEngine* ee, const IRBlock& block);
+            void flush();
+
+            /* Bump when the layout of IRInstruction, the decoder or the optimizer change */
+            static constexpr uint32_t VERSION = 6;
+
+        private:
+            void load();
+            static uint64_t hash_code(EmotionEngine* ee, const IRRange* ranges, uint32_t count);
+
+            std::string path;
+            bool enabled = false, loaded = false;
+
+            /* Read only view of the records that were on disk at load time */
+            uint8_t* view = nullptr;
+            size_t view_size = 0;
+
+            /* Record offsets in the view for every PC */
+            robin_hood::unordered_flat_map<uint32_t, std::vector<size_t>> index;
+
+            /* New records are appended here */
+            FILE* writer = nullptr;
+            int lock_fd = -1;
+            std::vector<uint8_t> pending;
+            static constexpr size_t FLUSH_SIZE = 64 * 1024;
+            robin_hood::unordered_flat_set<uint64_t> stored;
+        };
+	}
+}
@@ -1,28 +1,75 @@
 #include <cpu/ee/jit/jit.h>
+#include <cpu/ee/jit/optimizer.h>
 #include <cpu/ee/ee.h>
+#include <cpu/vu/vu.h>
 #include <fmt/core.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <csignal>
+#include <ucontext.h>
+#include <x86intrin.h>
 
 namespace ee
 {
 	namespace jit
 	{
+        namespace x86 = asmjit::x86;
+
+        /* Fastmem accesses that miss the window end up here */
+        static JITCompiler* fault_owner = nullptr;
+        static struct sigaction default_segv_action;
+
+        static void handle_segv(int signal, siginfo_t* info, void* raw_context)
+        {
+            auto context = static_cast<ucontext_t*>(raw_context);
+            auto rip = reinterpret_cast<uint8_t*>(context->uc_mcontext.gregs[REG_RIP]);
+            if (fault_owner && fault_owner->handle_fault(rip, info->si_addr))
+            {
+                context->uc_mcontext.gregs[REG_RIP] = reinterpret_cast<greg_t>(rip);
+                return;
+            }
+
+            /* A genuine crash, let it happen when the instruction retries */
+            sigaction(SIGSEGV, &default_segv_action, nullptr);
+        }
+
 		JITCompiler::JITCompiler(EmotionEngine* parent) :
             ee(parent), irbuilder(parent)
 		{
+            struct sigaction action = {};
+            action.sa_sigaction = handle_segv;
+            action.sa_flags = SA_SIGINFO;
+            sigemptyset(&action.sa_mask);
+
+            sigaction(SIGSEGV, &action, &default_segv_action);
+            fault_owner = this;
+
+            profiler.set_code_cache(&cache);
 		}
 		
 		JITCompiler::~JITCompiler()
 		{
+            sigaction(SIGSEGV, &default_segv_action, nullptr);
+            fault_owner = nullptr;
+
+            /* The worker might be using the emitter */
+            compile_queue.stop();
+
             delete code;
             delete builder;
 		}
 
 		void JITCompiler::reset()
 		{
+            /* The emitter is rebuilt below, so get it back from the worker first */
+            drain_compile_queue();
+            compile_queue.stop();
+
             code = new asmjit::CodeHolder;
             code->init(runtime.environment());
             code->setLogger(&logger);
-            builder = new asmjit::x86::Assembler(code);
+            builder = new x86::Assembler(code);
 																		
 			/* Emit block dispatcher */
             emit_block_dispatcher();
@@ -32,21 +79,46 @@ namespace ee
                 common::Emulator::terminate("[JIT] Could not compile entry function!\n");
             }
 
+            perf_map.add_code(reinterpret_cast<void*>(entry), code->codeSize(), "ee_dispatcher");
+
+            code->reset();
+            code->init(runtime.environment());
+            code->setLogger(&logger);
+            code->attach(builder);
+            emit_block_trampoline();
+
+            if (auto error = runtime.add(&trampoline, code); error)
+            {
+                common::Emulator::terminate("[JIT] Could not compile block trampoline!\n");
+            }
+
+            perf_map.add_code(reinterpret_cast<void*>(trampoline), code->codeSize(), "ee_trampoline");
+
             fmt::print("{}\n", logger.data());
+
+            if (background_compile)
+            {
+                compile_queue.start([this](CompileJob& job)
+                {
+                    if (!job.optimized)
+                        optimizer::optimize(job.ir);
+                    emit_code(job.ir, job.profile);
+                });
+            }
 		}
 
         void JITCompiler::emit_register_flush()
         {
-            static asmjit::x86::Gp preserved[] = { asmjit::x86::rbx, asmjit::x86::r12, asmjit::x86::r13,
-                                                   asmjit::x86::r14, asmjit::x86::r15 };
+            static x86::Gp preserved[] = { x86::rbx, x86::r12, x86::r13,
+                                                   x86::r14, x86::r15 };
             for (auto& reg : preserved)
                 builder->push(reg);
         }
 
         void JITCompiler::emit_register_restore()
         {
-            static asmjit::x86::Gp preserved[] = { asmjit::x86::r15, asmjit::x86::r14, asmjit::x86::r13,
-                                                   asmjit::x86::r12, asmjit::x86::rbx };
+            static x86::Gp preserved[] = { x86::r15, x86::r14, x86::r13,
+                                                   x86::r12, x86::rbx };
             for (auto& reg : preserved)
                 builder->pop(reg);
         }
@@ -56,9 +128,120 @@ namespace ee
             return;
         }
 
-        BlockFunc JITCompiler::emit_native(IRBlock& block)
+        /* Instructions that access GPRs through the register allocator. The rest,
+           interpreter fallbacks and 128bit MMI operations, use the guest state in memory */
+        static bool uses_host_registers(const IRInstruction& instr)
+        {
+            switch (instr.operation)
+            {
+            case IROperation::None:
+            case IROperation::AddWord:
+            case IROperation::AddDword:
+            case IROperation::SubWord:
+            case IROperation::SubDword:
+            case IROperation::AndWord:
+            case IROperation::OrWord:
+            case IROperation::XorWord:
+            case IROperation::NorWord:
+            case IROperation::SetLessThanWord:
+            case IROperation::LogicalShiftLeftWord:
+            case IROperation::LogicalShiftRightWord:
+            case IROperation::ArithmeticShiftRightWord:
+            case IROperation::LogicalShiftLeftDword:
+            case IROperation::LogicalShiftRightDword:
+            case IROperation::ArithmeticShiftRightDword:
+            case IROperation::LoadUpperImmediate:
+            case IROperation::LoadConstant:
+            case IROperation::Move:
+            case IROperation::MulWord:
+            case IROperation::MulAddWord:
+            case IROperation::DivWord:
+            case IROperation::MoveToHi:
+            case IROperation::MoveToLo:
+            case IROperation::MoveFromHi:
+            case IROperation::MoveFromLo:
+            case IROperation::LoadByte:
+            case IROperation::LoadHalfWord:
+            case IROperation::LoadWord:
+            case IROperation::LoadDword:
+            case IROperation::StoreByte:
+            case IROperation::StoreHalfWord:
+            case IROperation::StoreWord:
+            case IROperation::StoreDword:
+            case IROperation::LoadFloat:
+            case IROperation::StoreFloat:
+            case IROperation::LoadWordLeft:
+            case IROperation::LoadWordRight:
+            case IROperation::StoreWordLeft:
+            case IROperation::StoreWordRight:
+            case IROperation::LoadDwordLeft:
+            case IROperation::LoadDwordRight:
+            case IROperation::StoreDwordLeft:
+            case IROperation::StoreDwordRight:
+            case IROperation::MoveToCop1:
+            case IROperation::MoveControlToCop1:
+            case IROperation::MoveControlFromCop1:
+            case IROperation::MoveControlToCop2:
+            case IROperation::MoveControlFromCop2:
+            case IROperation::VectorAdd:
+            case IROperation::VectorSub:
+            case IROperation::VectorSubAccumulator:
+            case IROperation::VectorMulAddAccumulator:
+            case IROperation::VectorMulSubAccumulator:
+            case IROperation::Jump:
+            case IROperation::JumpLink:
+            case IROperation::Branch:
+            case IROperation::BranchLikely:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        static x86::Mem fpr_ptr(uint16_t fpr)
         {
-            BlockFunc handler = nullptr;
+            return x86::dword_ptr(x86::rbx, offsetof(EmotionEngine, cop1) + offsetof(COP1, fpr) + fpr * sizeof(FPR));
+        }
+
+        static x86::Mem fcr_ptr(uint16_t fcr)
+        {
+            size_t offset = fcr == 0 ? offsetof(COP1, fcr0) : offsetof(COP1, fcr31);
+            return x86::dword_ptr(x86::rbx, offsetof(EmotionEngine, cop1) + offset);
+        }
+
+        static x86::Mem hi_ptr(uint8_t pipeline)
+        {
+            return x86::qword_ptr(x86::rbx, pipeline ? offsetof(EmotionEngine, hi1) : offsetof(EmotionEngine, hi0));
+        }
+
+        static x86::Mem lo_ptr(uint8_t pipeline)
+        {
+            return x86::qword_ptr(x86::rbx, pipeline ? offsetof(EmotionEngine, lo1) : offsetof(EmotionEngine, lo0));
+        }
+
+        /* VU0 registers, relative to the pointer load_vu0_regs puts in rdx */
+        static x86::Mem vf_ptr(uint16_t vf)
+        {
+            return x86::xmmword_ptr(x86::rdx, offsetof(vu::Registers, vf) + vf * sizeof(vu::Vector));
+        }
+
+        static x86::Mem vi_ptr(uint16_t id)
+        {
+            /* CFC2/CTC2 index the integer and control registers as one array */
+            return x86::dword_ptr(x86::rdx, id * sizeof(uint32_t));
+        }
+
+        Block JITCompiler::emit_native(IRBlock& block)
+        {
+            BlockProfile* profile = profiler.enabled() ? profiler.profile(block.pc) : nullptr;
+            emit_code(block, profile);
+            return install_code(block, profile);
+        }
+
+        void JITCompiler::emit_code(IRBlock& block, BlockProfile* profile)
+        {
+            exit_labels.clear();
+            fastmem_labels.clear();
             logger.clear();
 
             /* Init the asmjit code buffer */
@@ -66,33 +249,168 @@ namespace ee
             code->init(runtime.environment());
             code->setLogger(&logger);
             code->attach(builder);
+            code->newSection(&cold, ".cold", SIZE_MAX, asmjit::SectionFlags::kExecutable, 1);
 
             auto block_end = builder->newLabel();
             auto block_epilogue = builder->newLabel();
-            auto dec_pc = builder->newLabel();
+            auto block_exit = builder->newLabel();
 
-            /* Push new stack frame for our block */
-            builder->push(asmjit::x86::rbp);
-            builder->mov(asmjit::x86::rbp, asmjit::x86::rsp);
-            //builder->sub(asmjit::x86::rsp, 0x1B8);
-            //emit_register_flush();
+            /* Push new stack frame for our block. The callee saved registers
+               the allocator uses are preserved once by the dispatcher */
+            builder->push(x86::rbp);
+            builder->mov(x86::rbp, x86::rsp);
 
-            /* Set EE PC to the start of the block */
-            builder->mov(asmjit::x86::rbx, asmjit::x86::rdi);
-            auto pc_ptr = asmjit::x86::dword_ptr(asmjit::x86::rdi, offsetof(EmotionEngine, pc));
+            /* Set EE PC to the start of the block. Linked blocks jump here
+               directly, so rely on the dispatcher for the EE pointer in rbx */
+            auto pc_ptr = x86::dword_ptr(x86::rbx, offsetof(EmotionEngine, pc));
             builder->mov(pc_ptr, block.pc);
 
+            /* Count the execution and remember when it started */
+            if (profile)
+            {
+                builder->mov(x86::rcx, reinterpret_cast<uint64_t>(profile));
+                builder->inc(x86::qword_ptr(x86::rcx, offsetof(BlockProfile, executions)));
+                builder->rdtsc();
+                builder->shl(x86::rdx, 32);
+                builder->or_(x86::rax, x86::rdx);
+                builder->mov(x86::qword_ptr(x86::rcx, offsetof(BlockProfile, entry_tsc)), x86::rax);
+            }
+
+            allocator.analyze(block, uses_host_registers);
+            allocator.load_live_in(builder);
+
             for (int i = 0; i < block.size(); i++)
             {
                 auto& instr = block[i];
+                bool in_memory = !uses_host_registers(instr);
+                if (in_memory)
+                    allocator.spill(builder, i);
+
                 switch (instr.operation)
                 {
                 case IROperation::None:
                     break;
+                case IROperation::AddWord:
+                case IROperation::AddDword:
+                case IROperation::SubWord:
+                case IROperation::SubDword:
+                    emit_arithmetic(instr);
+                    break;
+                case IROperation::AndWord:
+                case IROperation::OrWord:
+                case IROperation::XorWord:
+                case IROperation::NorWord:
+                    emit_logic(instr);
+                    break;
+                case IROperation::SetLessThanWord:
+                    emit_set_less_than(instr);
+                    break;
+                case IROperation::LogicalShiftLeftWord:
+                case IROperation::LogicalShiftRightWord:
+                case IROperation::ArithmeticShiftRightWord:
+                case IROperation::LogicalShiftLeftDword:
+                case IROperation::LogicalShiftRightDword:
+                case IROperation::ArithmeticShiftRightDword:
+                    emit_shift(instr);
+                    break;
+                case IROperation::LoadUpperImmediate:
+                case IROperation::LoadConstant:
+                    emit_load_immediate(instr);
+                    break;
+                case IROperation::Move:
+                    emit_move(instr);
+                    break;
+                case IROperation::MulWord:
+                case IROperation::MulAddWord:
+                    emit_multiply(instr);
+                    break;
+                case IROperation::DivWord:
+                    emit_divide(instr);
+                    break;
+                case IROperation::MoveToHi:
+                case IROperation::MoveToLo:
+                case IROperation::MoveFromHi:
+                case IROperation::MoveFromLo:
+                    emit_hilo_move(instr);
+                    break;
+                case IROperation::LoadByte:
+                case IROperation::LoadHalfWord:
+                case IROperation::LoadWord:
+                case IROperation::LoadDword:
+                case IROperation::LoadFloat:
+                    emit_load(instr);
+                    break;
+                case IROperation::StoreByte:
+                case IROperation::StoreHalfWord:
+                case IROperation::StoreWord:
+                case IROperation::StoreDword:
+                case IROperation::StoreFloat:
+                    emit_store(instr);
+                    break;
+                case IROperation::LoadQword:
+                case IROperation::StoreQword:
+                case IROperation::LoadQwordCop2:
+                case IROperation::StoreQwordCop2:
+                    emit_qword_access(instr);
+                    break;
+                case IROperation::LoadWordLeft:
+                case IROperation::LoadWordRight:
+                case IROperation::StoreWordLeft:
+                case IROperation::StoreWordRight:
+                case IROperation::LoadDwordLeft:
+                case IROperation::LoadDwordRight:
+                case IROperation::StoreDwordLeft:
+                case IROperation::StoreDwordRight:
+                    emit_unaligned(instr);
+                    break;
+                case IROperation::ParallelAnd:
+                case IROperation::ParallelOr:
+                case IROperation::ParallelXor:
+                case IROperation::ParallelNor:
+                case IROperation::ParallelSubByte:
+                case IROperation::ParallelSubWord:
+                case IROperation::ParallelAddUnsignedSatWord:
+                case IROperation::ParallelCopyLowerDword:
+                case IROperation::ParallelCopyUpperDword:
+                case IROperation::ParallelCopyHalfWord:
+                case IROperation::ParallelLeadingZeroWord:
+                    emit_parallel(instr);
+                    break;
+                case IROperation::MoveToCop1:
+                case IROperation::MoveControlToCop1:
+                case IROperation::MoveControlFromCop1:
+                    emit_cop1_move(instr);
+                    break;
+                case IROperation::FloatAddAccumulator:
+                case IROperation::FloatMultiplyAdd:
+                    emit_float(instr);
+                    break;
+                case IROperation::MoveToCop2:
+                case IROperation::MoveFromCop2:
+                case IROperation::MoveControlToCop2:
+                case IROperation::MoveControlFromCop2:
+                    emit_cop2_move(instr);
+                    break;
+                case IROperation::VectorAdd:
+                case IROperation::VectorSub:
+                case IROperation::VectorSubAccumulator:
+                case IROperation::VectorMulAddAccumulator:
+                case IROperation::VectorMulSubAccumulator:
+                    emit_vector(instr);
+                    break;
+                case IROperation::Jump:
+                case IROperation::JumpLink:
+                case IROperation::Branch:
+                case IROperation::BranchLikely:
+                    emit_branch(instr, block_epilogue);
+                    break;
                 default:
                     emit_fallback(instr);
                 }
 
+                if (in_memory)
+                    allocator.reload(builder, i);
+
                 /* Normally in the interpreter the pc is always 2 instructions ahead of the
                  * one currently being executed, assuming no branches. This causes problems
                  * in the JIT if the instruction uses fetch_next() to direct jump, as that
@@ -104,137 +422,1902 @@ namespace ee
                     builder->sub(pc_ptr, 4);
                 }
 
-                /* When a branch likely instructions fails the delay slot is skipped! */
-                if (block[i].operation == IROperation::BranchLikely)
-                {
-                    auto skip_ptr = asmjit::x86::byte_ptr(asmjit::x86::rdi, offsetof(EmotionEngine, skip_branch_delay));
-                    builder->cmp(skip_ptr, 1);
-                    builder->mov(skip_ptr, 0);
-                    builder->je(dec_pc);
-                }
+                /* ERET still reports its jump the interpreter way */
+                if (block[i].operation == IROperation::ExceptionReturn)
+                    builder->mov(x86::byte_ptr(x86::rbx, offsetof(EmotionEngine, branch_taken)), 0);
             }
 
+            /* The not taken branch likely path joins here
+               after writing back the registers on its own */
+            allocator.writeback(builder);
             builder->bind(block_epilogue);
 
+            /* Every way out of the block passes through here, linked exits included */
+            if (profile)
+            {
+                builder->rdtsc();
+                builder->shl(x86::rdx, 32);
+                builder->or_(x86::rax, x86::rdx);
+                builder->mov(x86::rcx, reinterpret_cast<uint64_t>(profile));
+                builder->sub(x86::rax, x86::qword_ptr(x86::rcx, offsetof(BlockProfile, entry_tsc)));
+                builder->add(x86::qword_ptr(x86::rcx, offsetof(BlockProfile, host_cycles)), x86::rax);
+            }
+
             /* Decrement cycles counter in the EE */
-            auto cycles_ptr = asmjit::x86::dword_ptr(asmjit::x86::rdi, offsetof(EmotionEngine, cycles_to_execute));
+            auto cycles_ptr = x86::dword_ptr(x86::rbx, offsetof(EmotionEngine, cycles_to_execute));
             builder->sub(cycles_ptr, block.total_cycles);
 
-            /* Move the PC forward by the block size, ONLY if a jump didn't occur */
-            auto taken_ptr = asmjit::x86::byte_ptr(asmjit::x86::rdi, offsetof(EmotionEngine, branch_taken));
-            builder->cmp(taken_ptr, 1);
-            builder->mov(taken_ptr, 0);
-            builder->je(block_end);
-            builder->mov(pc_ptr, block.pc + block.instructions.size() * 4);
+            /* The branch already stored the next PC. Chain to the successors we can
+               tell at compile time. The optimizer may have stripped the delay slot,
+               so look for the branch itself */
+            auto branch = std::find_if(block.instructions.rbegin(), block.instructions.rend(),
+                                       [](const IRInstruction& instr) { return instr.is_branch; });
+            auto& last = branch != block.instructions.rend() ? *branch : block[block.size() - 1];
+            bool conditional = last.is_branch && (last.operation == IROperation::Branch ||
+                                                  last.operation == IROperation::BranchLikely);
+            bool direct = last.is_branch && last.immediate_data &&
+                          (last.operation == IROperation::Jump || last.operation == IROperation::JumpLink);
+
+            uint32_t target = 0;
+            if (conditional)
+            {
+                int32_t offset = (int16_t)last.immediate << 2;
+                target = last.pc + 4 + offset;
+
+                builder->cmp(pc_ptr, target);
+                builder->jne(block_end);
+            }
+            else if (direct)
+            {
+                target = ((last.pc + 4) & 0xF0000000) | (last.immediate << 2);
+            }
+
+            /* The EE is the only thing running during its timeslice, so an idle loop would
+               spin until the slice ends. Skip ahead to the point where the rest of the
+               system catches up, which also makes the link below return to the dispatcher */
+            if ((conditional || direct) && block.idle_loop)
+                builder->mov(cycles_ptr, 0);
+
+            /* Calls remember where they return to, jr $ra checks that before the dispatcher */
+            bool call = last.is_branch && last.operation == IROperation::JumpLink &&
+                        (last.immediate_data || last.destination == 31);
+            bool ret = last.is_branch && last.operation == IROperation::Jump &&
+                       !last.immediate_data && last.source == 31;
+            if (call)
+                emit_return_push(last.pc + 8);
+
+            if (conditional || direct)
+                emit_link(target, block_exit);
+            else if (ret)
+                emit_return_predict(block_exit);
+            else
+                builder->jmp(block_exit);
+
+            /* Not taken */
             builder->bind(block_end);
+            if (conditional)
+                emit_link(last.pc + 8, block_exit);
 
             /* Clean up stack before exiting */
-            //emit_register_restore();
-            //builder->add(asmjit::x86::rsp, 0x1B8);
-            builder->pop(asmjit::x86::rbp);
+            builder->bind(block_exit);
+            builder->pop(x86::rbp);
             builder->ret();
+        }
+
+        Block JITCompiler::install_code(IRBlock& block, BlockProfile* profile)
+        {
+            Block result;
+            result.pc = block.pc;
+            result.end = block.end;
+            result.ranges = block.ranges;
+
+            /* Build! Make room for the block if the cache is full */
+            auto address = cache.add(code);
+            if (!address)
+            {
+                flush();
+                if (address = cache.add(code); !address)
+                    common::Emulator::terminate("[JIT] Could not compile block at PC: {:#x}\n", block.pc);
+            }
 
-            /* Decrement pc to account for the call to fetch_next and
-             * jump directly to the epilogue */
-            builder->bind(dec_pc);
-            builder->sub(pc_ptr, 4);
-            builder->jmp(block_epilogue);
+            result.code = reinterpret_cast<BlockFunc>(address);
+            perf_map.add_block(address, code->codeSize(), block.pc, block.end);
+
+            if (ee->backend == Backend::Lockstep)
+                result.ir = std::make_shared<const std::vector<IRInstruction>>(block.instructions);
+
+            if (profile)
+            {
+                profile->end = block.end;
+                profile->ir_count = block.size();
+                profile->code_size = code->codeSize();
+                profile->compilations++;
+            }
 
-            /* Build! */
-            if (auto error = runtime.add(&handler, code); error)
+            for (auto& [target, label] : exit_labels)
             {
-                common::Emulator::terminate("[JIT] Could not compile block at PC: {:#x}\n", block.pc);
+                auto jump = address + code->labelOffsetFromBase(label);
+                result.exits.push_back(BlockLink{ target, jump });
             }
 
+            for (auto& [site, slow] : fastmem_labels)
+                fastmem_sites[address + code->labelOffsetFromBase(site)] = address + code->labelOffsetFromBase(slow);
+
             //fmt::print("{}\n", logger.data());
 
-            return handler;
+            return result;
         }
 
-        void JITCompiler::emit_fallback(IRInstruction& instr)
+        /* jmp rel32 of a linkable exit. The zero offset falls through to the next instruction */
+        static const uint8_t LINK_JUMP[] = { 0xE9, 0x00, 0x00, 0x00, 0x00 };
+
+        void JITCompiler::emit_link(uint32_t target, const asmjit::Label& exit)
         {
-            /* The interpreter functions were written to not depend too much on internal
-             * state, so we only need to update the instr to make sure branches read correct
-             * values
-             */
-             auto instr_pc_ptr = asmjit::x86::dword_ptr(asmjit::x86::rdi,
-                                            offsetof(EmotionEngine, instr) +
-                                            offsetof(Instruction, pc));
-             auto instr_value_ptr = asmjit::x86::dword_ptr(asmjit::x86::rdi,
-                                            offsetof(EmotionEngine, instr) +
-                                            offsetof(Instruction, value));
+            /* Linked blocks never return to the dispatcher, so check the cycle budget here */
+            auto cycles_ptr = x86::dword_ptr(x86::rbx, offsetof(EmotionEngine, cycles_to_execute));
+            builder->cmp(cycles_ptr, 0);
+            builder->jle(exit);
+            builder->pop(x86::rbp);
 
-             builder->mov(instr_pc_ptr, instr.pc);
-             builder->mov(instr_value_ptr, instr.value);
+            /* jmp rel32 that falls through to the ret until the target gets compiled */
+            auto label = builder->newLabel();
+            builder->bind(label);
+            builder->embed(LINK_JUMP, sizeof(LINK_JUMP));
+            builder->ret();
 
-             builder->call(reinterpret_cast<uint64_t>(instr.handler));
-             builder->mov(asmjit::x86::rdi, asmjit::x86::rbx);
+            exit_labels.emplace_back(target, label);
+        }
 
-             /* Sometimes an instruction might write to GPR[0].
-                To avoid branches, reset the register each time */
-             //builder->mov(asmjit::x86::qqword_ptr(asmjit::x86::rdi, offsetof(EmotionEngine, gpr[0])), 0);
+        void JITCompiler::emit_return_push(uint32_t link)
+        {
+            static_assert(sizeof(ReturnStack::Entry) == 16);
+            auto stub = builder->newLabel();
+
+            /* top = (top + 1) % SIZE, then fill in the entry there */
+            auto top_ptr = x86::dword_ptr(x86::rdx, offsetof(ReturnStack, top));
+            builder->mov(x86::rdx, reinterpret_cast<uint64_t>(&return_stack));
+            builder->mov(x86::ecx, top_ptr);
+            builder->inc(x86::ecx);
+            builder->and_(x86::ecx, ReturnStack::SIZE - 1);
+            builder->mov(top_ptr, x86::ecx);
+            builder->shl(x86::ecx, 4);
+            builder->add(x86::rdx, x86::rcx);
+            builder->mov(x86::dword_ptr(x86::rdx, offsetof(ReturnStack, entries) + offsetof(ReturnStack::Entry, pc)), link);
+            builder->lea(x86::rax, x86::ptr(stub));
+            builder->mov(x86::qword_ptr(x86::rdx, offsetof(ReturnStack, entries) + offsetof(ReturnStack::Entry, code)), x86::rax);
+
+            /* The entry enters the block at the return address through an exit
+               of this block, so linking keeps it pointing at the current code */
+            builder->section(cold);
+            builder->bind(stub);
+            builder->embed(LINK_JUMP, sizeof(LINK_JUMP));
+            builder->ret();
+            builder->section(code->textSection());
+
+            exit_labels.emplace_back(link, stub);
         }
 
-        /* Look up the block cache for the block */
-        BlockFunc lookup_next_block(EmotionEngine* ee)
-		{
-            uint32_t pc = ee->pc;
+        void JITCompiler::emit_return_predict(const asmjit::Label& exit)
+        {
+            /* Same cycle budget check as a linked exit */
+            auto cycles_ptr = x86::dword_ptr(x86::rbx, offsetof(EmotionEngine, cycles_to_execute));
+            builder->cmp(cycles_ptr, 0);
+            builder->jle(exit);
 
-            JITCompiler* compiler = ee->compiler;
-            //fmt::print("[JIT] Searching for block at PC: {:#x}\n", pc);
+            auto top_ptr = x86::dword_ptr(x86::rdx, offsetof(ReturnStack, top));
+            builder->mov(x86::rdx, reinterpret_cast<uint64_t>(&return_stack));
+            builder->mov(x86::ecx, top_ptr);
+            builder->mov(x86::eax, x86::ecx);
+            builder->shl(x86::eax, 4);
+            builder->add(x86::rax, x86::rdx);
 
-            BlockFunc block = nullptr;
-            if (auto result = compiler->block_cache.find(pc); result == compiler->block_cache.end())
+            /* The jump already stored its target. Anything but the last
+               return address goes through the dispatcher */
+            builder->mov(x86::r8d, x86::dword_ptr(x86::rbx, offsetof(EmotionEngine, pc)));
+            builder->cmp(x86::r8d, x86::dword_ptr(x86::rax, offsetof(ReturnStack, entries) + offsetof(ReturnStack::Entry, pc)));
+            builder->jne(exit);
+
+            /* Only pop on a hit. Calls followed into a superblock never pushed
+               anything, so their returns miss without unbalancing the stack */
+            builder->dec(x86::ecx);
+            builder->and_(x86::ecx, ReturnStack::SIZE - 1);
+            builder->mov(top_ptr, x86::ecx);
+            builder->mov(x86::rax, x86::qword_ptr(x86::rax, offsetof(ReturnStack, entries) + offsetof(ReturnStack::Entry, code)));
+            builder->pop(x86::rbp);
+            builder->jmp(x86::rax);
+        }
+
+        bool JITCompiler::patch_jump(uint8_t* jump, BlockFunc target)
+        {
+            /* A null target restores the fall through to the dispatcher */
+            int64_t offset = 0;
+            if (target)
+                offset = reinterpret_cast<uint8_t*>(target) - (jump + 5);
+
+            if (offset != (int32_t)offset)
+                return false;
+
+            int32_t rel32 = offset;
+            std::memcpy(jump + 1, &rel32, sizeof(rel32));
+            return true;
+        }
+
+        void JITCompiler::link_block(Block& block)
+        {
+            /* Chain the exits of the new block to compiled successors */
+            for (auto& exit : block.exits)
             {
-                /* Block not found, recompile it */
-                IRBlock ir_block = compiler->irbuilder.generate(pc);
+                links[exit.target].push_back(exit.jump);
+                if (auto result = block_cache.find(exit.target); result != block_cache.end())
+                    patch_jump(exit.jump, result->second.code);
+            }
 
-                block = compiler->emit_native(ir_block);
-                compiler->block_cache[pc] = block;
+            /* And the blocks that were waiting for this one */
+            if (auto result = links.find(block.pc); result != links.end())
+            {
+                for (auto jump : result->second)
+                    patch_jump(jump, block.code);
             }
-            else
+        }
+
+        void JITCompiler::invalidate(uint32_t pc)
+        {
+            /* Interpreted blocks only have their IR to lose */
+            if (auto cold = cold_blocks.find(pc); cold != cold_blocks.end() && !cold->second.stale)
+            {
+                untrack_pages(pc, cold->second.ir.ranges);
+                if (&cold->second == running_cold)
+                    cold->second.stale = true;
+                else
+                    cold_blocks.erase(cold);
+            }
+
+            auto result = block_cache.find(pc);
+            if (result == block_cache.end())
+                return;
+
+            /* Return stack entries of the block would outlive its exits */
+            return_stack = {};
+
+            /* Send everyone that jumps here back to the dispatcher */
+            auto& block = result->second;
+            if (auto incoming = links.find(pc); incoming != links.end())
+            {
+                for (auto jump : incoming->second)
+                    patch_jump(jump, nullptr);
+            }
+
+            /* The exits of the block go away together with its code */
+            for (auto& exit : block.exits)
             {
-                block = result->second;
+                auto& jumps = links[exit.target];
+                jumps.erase(std::remove(jumps.begin(), jumps.end(), exit.jump), jumps.end());
             }
 
-            return block;
+            untrack_pages(pc, block.ranges);
+
+            uint32_t paddr = pc & common::KUSEG_MASKS[pc >> 29];
+            if (block_table.find(paddr) == &block)
+                block_table.erase(paddr);
+
+            block_cache.erase(result);
         }
 
-        void JITCompiler::run()
+        void JITCompiler::flush()
         {
-            entry(ee);
+            /* Only called from the dispatcher, when no block is running */
+            for (auto& [page, blocks] : page_blocks)
+                fastmem.protect(page, false);
+
+            /* Queued jobs belong to cold blocks that are about to go away */
+            compile_queue.clear();
+
+            block_cache.clear();
+            cold_blocks.clear();
+            block_table.clear();
+            links.clear();
+            return_stack = {};
+            page_blocks.clear();
+            code_pages.reset();
+            fastmem_sites.clear();
+            cache.flush();
         }
 
-        /* This function is responsible for emitting a dispatcher
-           that attempts to find and directly execute the next
-           block in the instruction stream. */
-        void JITCompiler::emit_block_dispatcher()
+        void JITCompiler::invalidate_page(uint32_t paddr)
         {
-            asmjit::Label loop_start = builder->newLabel();
+            auto result = page_blocks.find(paddr >> PAGE_SHIFT);
+            if (result == page_blocks.end())
+                return;
 
-            /*  do
+            /* Work on a copy, invalidate() edits the index */
+            auto blocks = result->second;
+            for (auto pc : blocks)
+                invalidate(pc);
+
+            block_table.invalidate_page(paddr);
+        }
+
+        bool JITCompiler::block_pages(uint32_t pc, uint32_t end, uint32_t& first, uint32_t& last)
+        {
+            uint32_t start = pc & common::KUSEG_MASKS[pc >> 29];
+            end = start + (end - pc) - 1;
+
+            /* BIOS code is read only, so only RAM blocks can go stale */
+            if (end >= RAM_PAGES << PAGE_SHIFT)
+                return false;
+
+            first = start >> PAGE_SHIFT;
+            last = end >> PAGE_SHIFT;
+            return true;
+        }
+
+        void JITCompiler::track_pages(uint32_t pc, const std::vector<IRRange>& ranges)
+        {
+            for (auto& range : ranges)
+            {
+                uint32_t first, last;
+                if (!block_pages(range.pc, range.end, first, last))
+                    continue;
+
+                for (uint32_t page = first; page <= last; page++)
                 {
-                    BlockFunc block = lookup_next_block(ee);
-                    block(ee);
-                } while (ee->cycles_to_execute > 0);
-            */
+                    /* Ranges of a superblock can share pages */
+                    auto& blocks = page_blocks[page];
+                    if (blocks.empty() || blocks.back() != pc)
+                        blocks.push_back(pc);
 
-            auto cycles_ptr = asmjit::x86::dword_ptr(asmjit::x86::rbx, offsetof(EmotionEngine, cycles_to_execute));
+                    /* Fastmem stores bypass EmotionEngine::write, so make
+                       them fault into the slow path on code pages */
+                    if (!code_pages[page])
+                    {
+                        code_pages.set(page);
+                        fastmem.protect(page, true);
+                    }
+                }
+            }
+        }
 
-            builder->push(asmjit::x86::rbx);
-            builder->mov(asmjit::x86::rbx, asmjit::x86::rdi);
-            builder->bind(loop_start);
+        void JITCompiler::untrack_pages(uint32_t pc, const std::vector<IRRange>& ranges)
+        {
+            /* Remove the block from the reverse page index */
+            for (auto& range : ranges)
+            {
+                uint32_t first, last;
+                if (!block_pages(range.pc, range.end, first, last))
+                    continue;
 
-            /* Call lookup_next_block */
-            builder->mov(asmjit::x86::rdi, asmjit::x86::rbx);
-            builder->call(reinterpret_cast<uint64_t>(lookup_next_block));
+                for (uint32_t page = first; page <= last; page++)
+                {
+                    auto result = page_blocks.find(page);
+                    if (result == page_blocks.end())
+                        continue;
+
+                    auto& blocks = result->second;
+                    blocks.erase(std::remove(blocks.begin(), blocks.end(), pc), blocks.end());
+                    if (blocks.empty())
+                    {
+                        page_blocks.erase(result);
+                        code_pages.reset(page);
+                        fastmem.protect(page, false);
+                    }
+                }
+            }
+        }
 
-            builder->mov(asmjit::x86::rdi, asmjit::x86::rbx);
-            builder->call(asmjit::x86::rax);
+        bool JITCompiler::handle_fault(uint8_t*& rip, void* address)
+        {
+            if (!fastmem.contains(address))
+                return false;
 
-            builder->cmp(cycles_ptr, 0);
-            builder->jg(loop_start);
-            builder->pop(asmjit::x86::rbx);
+            auto site = fastmem_sites.find(rip);
+            if (site == fastmem_sites.end())
+                return false;
+
+            /* The access is likely to miss again, so send it
+               straight to the slow path from now on */
+            uint8_t* slow = site->second;
+            int32_t rel32 = slow - (rip + 5);
+            rip[0] = 0xE9;
+            std::memcpy(rip + 1, &rel32, sizeof(rel32));
+
+            rip = slow;
+            return true;
+        }
+
+        void JITCompiler::load_gpr(const x86::Gp& reg, uint16_t gpr)
+        {
+            /* Fallbacks might have clobbered GPR[0], so never trust its memory */
+            if (gpr == 0)
+            {
+                builder->xor_(reg.r32(), reg.r32());
+                return;
+            }
+
+            if (auto host = allocator.use(builder, gpr, false))
+                builder->mov(reg, *host);
+            else
+                builder->mov(reg, gpr_ptr(gpr));
+        }
+
+        void JITCompiler::store_gpr(uint16_t gpr, const x86::Gp& reg)
+        {
+            if (auto host = allocator.use(builder, gpr, true))
+                builder->mov(*host, reg);
+            else
+                builder->mov(gpr_ptr(gpr), reg);
+        }
+
+        void JITCompiler::emit_arithmetic(IRInstruction& instr)
+        {
+            /* Immediate forms write to rt, register forms to rd.
+               Writes to GPR[0] have no effect so skip them */
+            uint16_t dest = instr.immediate_data ? instr.target : instr.destination;
+            if (dest == 0)
+                return;
+
+            bool dword = instr.operation == IROperation::AddDword ||
+                         instr.operation == IROperation::SubDword;
+            x86::Gp result = x86::rax;
+            if (!dword)
+                result = x86::eax;
+
+            load_gpr(x86::rax, instr.source);
+            if (instr.immediate_data)
+            {
+                /* The only immediate forms are ADDI(U) and DADDIU */
+                int32_t imm = (int16_t)instr.immediate;
+                builder->add(result, imm);
+            }
+            else
+            {
+                x86::Gp operand = dword ? x86::rcx : x86::ecx;
+                load_gpr(x86::rcx, instr.target);
+
+                if (instr.operation == IROperation::AddWord || instr.operation == IROperation::AddDword)
+                    builder->add(result, operand);
+                else
+                    builder->sub(result, operand);
+            }
+
+            /* Word operations sign extend their 32bit result */
+            if (!dword)
+                builder->movsxd(x86::rax, x86::eax);
+
+            store_gpr(dest, x86::rax);
+        }
+
+        void JITCompiler::emit_logic(IRInstruction& instr)
+        {
+            uint16_t dest = instr.immediate_data ? instr.target : instr.destination;
+            if (dest == 0)
+                return;
+
+            load_gpr(x86::rax, instr.source);
+            if (instr.immediate_data)
+            {
+                /* Logical immediates are zero extended so they fit in a positive imm32 */
+                uint32_t imm = instr.immediate;
+                switch (instr.operation)
+                {
+                case IROperation::AndWord: builder->and_(x86::rax, imm); break;
+                case IROperation::OrWord: builder->or_(x86::rax, imm); break;
+                case IROperation::XorWord: builder->xor_(x86::rax, imm); break;
+                default:
+                    common::Emulator::terminate("[JIT] Invalid immediate logic operation at PC: {:#x}\n", instr.pc);
+                }
+            }
+            else
+            {
+                load_gpr(x86::rcx, instr.target);
+                switch (instr.operation)
+                {
+                case IROperation::AndWord: builder->and_(x86::rax, x86::rcx); break;
+                case IROperation::OrWord: builder->or_(x86::rax, x86::rcx); break;
+                case IROperation::XorWord: builder->xor_(x86::rax, x86::rcx); break;
+                case IROperation::NorWord:
+                    builder->or_(x86::rax, x86::rcx);
+                    builder->not_(x86::rax);
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            store_gpr(dest, x86::rax);
+        }
+
+        void JITCompiler::emit_set_less_than(IRInstruction& instr)
+        {
+            uint16_t dest = instr.immediate_data ? instr.target : instr.destination;
+            if (dest == 0)
+                return;
+
+            load_gpr(x86::rax, instr.source);
+            if (instr.immediate_data)
+            {
+                /* Both SLTI and SLTIU sign extend the immediate, which is
+                   exactly what x86 does to imm32 operands of 64bit compares */
+                int32_t imm = (int16_t)instr.immediate;
+                builder->cmp(x86::rax, imm);
+            }
+            else
+            {
+                load_gpr(x86::rcx, instr.target);
+                builder->cmp(x86::rax, x86::rcx);
+            }
+
+            if (instr.signed_data)
+                builder->setl(x86::al);
+            else
+                builder->setb(x86::al);
+
+            builder->movzx(x86::eax, x86::al);
+            store_gpr(dest, x86::rax);
+        }
+
+        void JITCompiler::emit_shift(IRInstruction& instr)
+        {
+            uint16_t dest = instr.destination;
+            if (dest == 0)
+                return;
+
+            bool dword = instr.operation == IROperation::LogicalShiftLeftDword ||
+                         instr.operation == IROperation::LogicalShiftRightDword ||
+                         instr.operation == IROperation::ArithmeticShiftRightDword;
+            x86::Gp value = x86::rax;
+            if (!dword)
+                value = x86::eax;
+
+            /* x86 masks the shift count to 5 bits for 32bit operands and 6 bits
+               for 64bit ones, which matches the variable MIPS shifts */
+            auto shift = [&](const auto& amount)
+            {
+                switch (instr.operation)
+                {
+                case IROperation::LogicalShiftLeftWord:
+                case IROperation::LogicalShiftLeftDword:
+                    builder->shl(value, amount);
+                    break;
+                case IROperation::LogicalShiftRightWord:
+                case IROperation::LogicalShiftRightDword:
+                    builder->shr(value, amount);
+                    break;
+                default:
+                    builder->sar(value, amount);
+                    break;
+                }
+            };
+
+            load_gpr(x86::rax, instr.target);
+            if (instr.immediate_data)
+            {
+                /* The decoder has already added 32 to the amount of the *32 variants */
+                shift(asmjit::imm(instr.shift));
+            }
+            else
+            {
+                load_gpr(x86::rcx, instr.source);
+                shift(x86::cl);
+            }
+
+            if (!dword)
+                builder->movsxd(x86::rax, x86::eax);
+
+            store_gpr(dest, x86::rax);
+        }
+
+        void JITCompiler::emit_load_immediate(IRInstruction& instr)
+        {
+            if (instr.target == 0)
+                return;
+
+            /* Constants folded by the optimizer are sign extended 32bit values,
+               the links of inlined jals are zero extended */
+            int64_t value = (int32_t)instr.immediate;
+            if (instr.operation == IROperation::LoadConstant && !instr.signed_data)
+                value = instr.immediate;
+            if (instr.operation == IROperation::LoadUpperImmediate)
+                value = (int32_t)(instr.immediate << 16);
+
+            builder->mov(x86::rax, value);
+            store_gpr(instr.target, x86::rax);
+        }
+
+        void JITCompiler::emit_move(IRInstruction& instr)
+        {
+            if (instr.destination == 0)
+                return;
+
+            /* Keep the old value around in case the condition fails */
+            load_gpr(x86::rax, instr.source);
+            load_gpr(x86::rcx, instr.destination);
+            load_gpr(x86::rdx, instr.target);
+            builder->test(x86::rdx, x86::rdx);
+
+            /* MOVZ moves when rt is zero, MOVN when it isn't */
+            if (instr.condition == BranchCond::Equal)
+                builder->cmove(x86::rcx, x86::rax);
+            else
+                builder->cmovne(x86::rcx, x86::rax);
+
+            store_gpr(instr.destination, x86::rcx);
+        }
+
+        void JITCompiler::emit_multiply(IRInstruction& instr)
+        {
+            /* The product of two extended words always fits in 64 bits,
+               so a single imul covers MULT and MULTU */
+            load_gpr(x86::rax, instr.source);
+            load_gpr(x86::rcx, instr.target);
+            if (instr.signed_data)
+            {
+                builder->movsxd(x86::rax, x86::eax);
+                builder->movsxd(x86::rcx, x86::ecx);
+            }
+            else
+            {
+                builder->mov(x86::eax, x86::eax);
+                builder->mov(x86::ecx, x86::ecx);
+            }
+
+            builder->imul(x86::rax, x86::rcx);
+
+            /* MADD accumulates onto the 64bit value made of the low words of HI and LO */
+            if (instr.operation == IROperation::MulAddWord)
+            {
+                builder->mov(x86::rdx, lo_ptr(instr.pipeline));
+                builder->mov(x86::edx, x86::edx);
+                builder->mov(x86::r8, hi_ptr(instr.pipeline));
+                builder->shl(x86::r8, 32);
+                builder->or_(x86::rdx, x86::r8);
+                builder->add(x86::rax, x86::rdx);
+            }
+
+            /* Both halves end up sign extended, MULT also copies LO to rd */
+            builder->mov(x86::rdx, x86::rax);
+            builder->sar(x86::rdx, 32);
+            builder->movsxd(x86::rax, x86::eax);
+            builder->mov(lo_ptr(instr.pipeline), x86::rax);
+            builder->mov(hi_ptr(instr.pipeline), x86::rdx);
+
+            if (instr.destination != 0)
+                store_gpr(instr.destination, x86::rax);
+        }
+
+        void JITCompiler::emit_divide(IRInstruction& instr)
+        {
+            auto by_zero = builder->newLabel();
+            auto by_minus_one = builder->newLabel();
+            auto done = builder->newLabel();
+
+            /* x86 faults on a zero divisor and on INT_MIN / -1, while the R5900
+               returns a defined result for both. They are handled out of line */
+            load_gpr(x86::rax, instr.source);
+            load_gpr(x86::rcx, instr.target);
+            builder->test(x86::ecx, x86::ecx);
+            builder->jz(by_zero);
+
+            if (instr.signed_data)
+            {
+                builder->cmp(x86::ecx, -1);
+                builder->je(by_minus_one);
+                builder->cdq();
+                builder->idiv(x86::ecx);
+            }
+            else
+            {
+                builder->xor_(x86::edx, x86::edx);
+                builder->div(x86::ecx);
+            }
+
+            /* LO gets the quotient and HI the remainder */
+            builder->bind(done);
+            builder->movsxd(x86::rax, x86::eax);
+            builder->movsxd(x86::rdx, x86::edx);
+            builder->mov(lo_ptr(instr.pipeline), x86::rax);
+            builder->mov(hi_ptr(instr.pipeline), x86::rdx);
+
+            builder->section(cold);
+
+            /* The remainder is the dividend. The signed quotient is -1
+               for positive dividends and 1 for negative ones */
+            builder->bind(by_zero);
+            builder->mov(x86::edx, x86::eax);
+            if (instr.signed_data)
+            {
+                builder->sar(x86::eax, 31);
+                builder->not_(x86::eax);
+                builder->or_(x86::eax, 1);
+            }
+            else
+            {
+                builder->mov(x86::eax, -1);
+            }
+            builder->jmp(done);
+
+            /* Negating INT_MIN wraps around to INT_MIN, just like the R5900 */
+            if (instr.signed_data)
+            {
+                builder->bind(by_minus_one);
+                builder->neg(x86::eax);
+                builder->xor_(x86::edx, x86::edx);
+                builder->jmp(done);
+            }
+
+            builder->section(code->textSection());
+        }
+
+        void JITCompiler::emit_hilo_move(IRInstruction& instr)
+        {
+            bool hi = instr.operation == IROperation::MoveToHi || instr.operation == IROperation::MoveFromHi;
+            auto ptr = hi ? hi_ptr(instr.pipeline) : lo_ptr(instr.pipeline);
+
+            if (instr.operation == IROperation::MoveToHi || instr.operation == IROperation::MoveToLo)
+            {
+                load_gpr(x86::rax, instr.source);
+                builder->mov(ptr, x86::rax);
+                return;
+            }
+
+            if (instr.destination == 0)
+                return;
+
+            builder->mov(x86::rax, ptr);
+            store_gpr(instr.destination, x86::rax);
+        }
+
+        void JITCompiler::emit_address(IRInstruction& instr)
+        {
+            if (instr.constant_address)
+            {
+                builder->mov(x86::ecx, instr.address);
+                return;
+            }
+
+            /* The 32bit add also clears the upper half of rcx,
+               leaving the guest virtual address as an offset in the window */
+            load_gpr(x86::rcx, instr.source);
+            if (int32_t offset = (int16_t)instr.immediate; offset)
+                builder->add(x86::ecx, offset);
+            else
+                builder->mov(x86::ecx, x86::ecx);
+        }
+
+        /* Bytes written by a store, zero for everything else */
+        static int store_size(const IRInstruction& instr)
+        {
+            switch (instr.operation)
+            {
+            case IROperation::StoreByte: return 1;
+            case IROperation::StoreHalfWord: return 2;
+            case IROperation::StoreWord:
+            case IROperation::StoreFloat:
+            case IROperation::StoreWordLeft:
+            case IROperation::StoreWordRight: return 4;
+            case IROperation::StoreDword:
+            case IROperation::StoreDwordLeft:
+            case IROperation::StoreDwordRight: return 8;
+            case IROperation::StoreQword:
+            case IROperation::StoreQwordCop2: return 16;
+            default: return 0;
+            }
+        }
+
+        /* Fastmem stores bypass the write journal. In lockstep they report what
+           they are about to overwrite, so stray writes of the JIT show up */
+        static void journal_fastmem_store(EmotionEngine* ee, uint32_t vaddr, uint32_t size)
+        {
+            uint32_t paddr = vaddr & common::KUSEG_MASKS[vaddr >> 29];
+            uint8_t* memory = ee->memory_ptr(paddr);
+            if (!ee->journal || !memory)
+                return;
+
+            MemoryWrite entry = {};
+            entry.paddr = paddr;
+            entry.size = size;
+            std::memcpy(entry.old_data, memory, size);
+            ee->journal->writes.push_back(entry);
+        }
+
+        template <typename Func>
+        void JITCompiler::emit_fastmem(IRInstruction& instr, int size, Func&& access)
+        {
+            auto site = builder->newLabel();
+            auto slow = builder->newLabel();
+            auto resume = builder->newLabel();
+
+            /* Misaligned accesses raise an address error, leave them to the interpreter */
+            if (size > 1)
+            {
+                builder->test(x86::ecx, size - 1);
+                builder->jnz(slow);
+            }
+
+            /* rcx holds the address, rdx, r8 and xmm0 the data of the store */
+            if (int bytes = store_size(instr); bytes && ee->backend == Backend::Lockstep)
+            {
+                builder->sub(x86::rsp, 48);
+                builder->movdqu(x86::xmmword_ptr(x86::rsp), x86::xmm0);
+                builder->mov(x86::qword_ptr(x86::rsp, 16), x86::rcx);
+                builder->mov(x86::qword_ptr(x86::rsp, 24), x86::rdx);
+                builder->mov(x86::qword_ptr(x86::rsp, 32), x86::r8);
+                builder->mov(x86::rdi, x86::rbx);
+                builder->mov(x86::esi, x86::ecx);
+                builder->mov(x86::edx, bytes);
+                builder->call(reinterpret_cast<uint64_t>(journal_fastmem_store));
+                builder->movdqu(x86::xmm0, x86::xmmword_ptr(x86::rsp));
+                builder->mov(x86::rcx, x86::qword_ptr(x86::rsp, 16));
+                builder->mov(x86::rdx, x86::qword_ptr(x86::rsp, 24));
+                builder->mov(x86::r8, x86::qword_ptr(x86::rsp, 32));
+                builder->add(x86::rsp, 48);
+            }
+
+            /* Pad the access so it can be patched with a jmp rel32. Read-modify-write
+               accesses get the slow path to register their store as well */
+            builder->bind(site);
+            size_t start = builder->offset();
+            if constexpr (std::is_invocable_v<Func, const asmjit::Label&>)
+                access(slow);
+            else
+                access();
+            while (builder->offset() - start < 5)
+                builder->nop();
+            builder->bind(resume);
+
+            /* The slow path runs the interpreter, which takes care of MMIO, address
+               errors and stores to code pages. Loads return their result in rax */
+            builder->section(cold);
+            builder->bind(slow);
+            allocator.writeback(builder, instr.gpr_reads() | instr.gpr_writes());
+            emit_fallback(instr);
+            if (instr.operation == IROperation::LoadFloat)
+                builder->mov(x86::eax, fpr_ptr(instr.target));
+            else if (instr.gpr_writes())
+                builder->mov(x86::rax, gpr_ptr(instr.target));
+            builder->jmp(resume);
+            builder->section(code->textSection());
+
+            fastmem_labels.emplace_back(site, slow);
+        }
+
+        /* Member function pointers follow the Itanium C++ ABI: the function, or one plus
+           its vtable offset for virtual ones, followed by the adjustment of this. The
+           component a handler is bound to never changes, so resolve the call up front */
+        template <typename Member>
+        static void* resolve_member(common::Component* component, Member member, uint8_t*& object)
+        {
+            struct
+            {
+                uintptr_t ptr;
+                ptrdiff_t adj;
+            } raw;
+
+            static_assert(sizeof(Member) == sizeof(raw));
+            std::memcpy(&raw, &member, sizeof(raw));
+
+            object = reinterpret_cast<uint8_t*>(component) + raw.adj;
+            if (raw.ptr & 1)
+            {
+                uint8_t* vtable = *reinterpret_cast<uint8_t**>(object);
+                return *reinterpret_cast<void**>(vtable + raw.ptr - 1);
+            }
+
+            return reinterpret_cast<void*>(raw.ptr);
+        }
+
+        bool JITCompiler::emit_mmio(IRInstruction& instr, int size, bool store)
+        {
+            /* Lockstep needs every write to go through the journal */
+            if (!instr.constant_address || (instr.address & (size - 1)) || ee->backend == Backend::Lockstep)
+                return false;
+
+            auto handler = (common::Handler<uint32_t>*)ee->mmio_handler(instr.address, store);
+            if (!handler || !(store ? (bool)handler->writer : (bool)handler->reader))
+                return false;
+
+            uint8_t* object = nullptr;
+            void* function = store ? resolve_member(handler->c, handler->writer, object)
+                                   : resolve_member(handler->c, handler->reader, object);
+
+            /* Stores have their data in rdx already. It's the whole GPR though, so cut it
+               down to the access the way the interpreter does, 64bit handlers see all of rdx */
+            if (store)
+            {
+                switch (size)
+                {
+                case 1: builder->movzx(x86::edx, x86::dl); break;
+                case 2: builder->movzx(x86::edx, x86::dx); break;
+                case 4: builder->mov(x86::edx, x86::edx); break;
+                }
+            }
+
+            uint32_t paddr = instr.address & common::KUSEG_MASKS[instr.address >> 29];
+            builder->mov(x86::rdi, reinterpret_cast<uint64_t>(object));
+            builder->mov(x86::esi, paddr);
+            builder->call(reinterpret_cast<uint64_t>(function));
+            if (store)
+                return true;
+
+            /* Handlers only return T, extend it the way the interpreter does */
+            switch (size)
+            {
+            case 1:
+                if (instr.signed_data)
+                    builder->movsx(x86::rax, x86::al);
+                else
+                    builder->movzx(x86::eax, x86::al);
+                break;
+            case 2:
+                if (instr.signed_data)
+                    builder->movsx(x86::rax, x86::ax);
+                else
+                    builder->movzx(x86::eax, x86::ax);
+                break;
+            case 4:
+                if (instr.signed_data)
+                    builder->movsxd(x86::rax, x86::eax);
+                else
+                    builder->mov(x86::eax, x86::eax);
+                break;
+            }
+
+            return true;
+        }
+
+        void JITCompiler::emit_load(IRInstruction& instr)
+        {
+            int size = instr.operation == IROperation::LoadByte ? 1 :
+                       instr.operation == IROperation::LoadHalfWord ? 2 :
+                       instr.operation == IROperation::LoadDword ? 8 : 4;
+            if (emit_mmio(instr, size, false))
+            {
+                if (instr.operation == IROperation::LoadFloat)
+                    builder->mov(fpr_ptr(instr.target), x86::eax);
+                else if (instr.target != 0)
+                    store_gpr(instr.target, x86::rax);
+                return;
+            }
+
+            emit_address(instr);
+
+            switch (instr.operation)
+            {
+            case IROperation::LoadByte:
+                emit_fastmem(instr, 1, [&]()
+                {
+                    if (instr.signed_data)
+                        builder->movsx(x86::rax, x86::byte_ptr(x86::r15, x86::rcx));
+                    else
+                        builder->movzx(x86::eax, x86::byte_ptr(x86::r15, x86::rcx));
+                });
+                break;
+            case IROperation::LoadHalfWord:
+                emit_fastmem(instr, 2, [&]()
+                {
+                    if (instr.signed_data)
+                        builder->movsx(x86::rax, x86::word_ptr(x86::r15, x86::rcx));
+                    else
+                        builder->movzx(x86::eax, x86::word_ptr(x86::r15, x86::rcx));
+                });
+                break;
+            case IROperation::LoadWord:
+                emit_fastmem(instr, 4, [&]()
+                {
+                    if (instr.signed_data)
+                        builder->movsxd(x86::rax, x86::dword_ptr(x86::r15, x86::rcx));
+                    else
+                        builder->mov(x86::eax, x86::dword_ptr(x86::r15, x86::rcx));
+                });
+                break;
+            case IROperation::LoadFloat:
+                /* LWC1 goes to an FPR */
+                emit_fastmem(instr, 4, [&]() { builder->mov(x86::eax, x86::dword_ptr(x86::r15, x86::rcx)); });
+                builder->mov(fpr_ptr(instr.target), x86::eax);
+                return;
+            default:
+                emit_fastmem(instr, 8, [&]()
+                {
+                    builder->mov(x86::rax, x86::qword_ptr(x86::r15, x86::rcx));
+                });
+                break;
+            }
+
+            if (instr.target != 0)
+                store_gpr(instr.target, x86::rax);
+        }
+
+        void JITCompiler::emit_store(IRInstruction& instr)
+        {
+            if (instr.operation == IROperation::StoreFloat)
+                builder->mov(x86::edx, fpr_ptr(instr.target));
+            else
+                load_gpr(x86::rdx, instr.target);
+
+            int size = instr.operation == IROperation::StoreByte ? 1 :
+                       instr.operation == IROperation::StoreHalfWord ? 2 :
+                       instr.operation == IROperation::StoreDword ? 8 : 4;
+            if (emit_mmio(instr, size, true))
+                return;
+
+            emit_address(instr);
+
+            switch (instr.operation)
+            {
+            case IROperation::StoreByte:
+                emit_fastmem(instr, 1, [&]() { builder->mov(x86::byte_ptr(x86::r15, x86::rcx), x86::dl); });
+                break;
+            case IROperation::StoreHalfWord:
+                emit_fastmem(instr, 2, [&]() { builder->mov(x86::word_ptr(x86::r15, x86::rcx), x86::dx); });
+                break;
+            case IROperation::StoreWord:
+            case IROperation::StoreFloat:
+                emit_fastmem(instr, 4, [&]() { builder->mov(x86::dword_ptr(x86::r15, x86::rcx), x86::edx); });
+                break;
+            default:
+                emit_fastmem(instr, 8, [&]() { builder->mov(x86::qword_ptr(x86::r15, x86::rcx), x86::rdx); });
+                break;
+            }
+        }
+
+        void JITCompiler::emit_qword_access(IRInstruction& instr)
+        {
+            /* The 16 byte alignment check of the fast path lets the access use movdqa.
+               Misaligned ones go to the interpreter, like everything else that misses.
+               LQC2/SQC2 move between memory and a VU0 vector register instead */
+            bool cop2 = instr.operation == IROperation::LoadQwordCop2 ||
+                        instr.operation == IROperation::StoreQwordCop2;
+            emit_address(instr);
+            if (instr.operation == IROperation::LoadQword || instr.operation == IROperation::LoadQwordCop2)
+            {
+                emit_fastmem(instr, 16, [&]()
+                {
+                    builder->movdqa(x86::xmm0, x86::xmmword_ptr(x86::r15, x86::rcx));
+                    if (cop2)
+                    {
+                        load_vu0_regs();
+                        builder->movdqa(vf_ptr(instr.target), x86::xmm0);
+                    }
+                    else if (instr.target != 0)
+                        store_qword(instr.target, x86::xmm0);
+                });
+            }
+            else
+            {
+                if (cop2)
+                {
+                    load_vu0_regs();
+                    builder->movdqa(x86::xmm0, vf_ptr(instr.target));
+                }
+                else
+                    load_qword(x86::xmm0, instr.target);
+
+                emit_fastmem(instr, 16, [&]() { builder->movdqa(x86::xmmword_ptr(x86::r15, x86::rcx), x86::xmm0); });
+            }
+        }
+
+        void JITCompiler::emit_unaligned(IRInstruction& instr)
+        {
+            bool left = false, store = false, dword = false;
+            switch (instr.operation)
+            {
+            case IROperation::LoadWordLeft: left = true; break;
+            case IROperation::LoadWordRight: break;
+            case IROperation::StoreWordLeft: left = store = true; break;
+            case IROperation::StoreWordRight: store = true; break;
+            case IROperation::LoadDwordLeft: left = dword = true; break;
+            case IROperation::LoadDwordRight: dword = true; break;
+            case IROperation::StoreDwordLeft: left = store = dword = true; break;
+            default: store = dword = true; break;
+            }
+
+            /* The accesses work on the aligned word or doubleword around the address.
+               r8 holds the bit offset of the address within it, r11 the old rt of loads */
+            int size = dword ? 8 : 4;
+            uint32_t top = size * 8 - 8;
+            uint64_t ones = dword ? ~0ull : 0xffffffffull;
+            auto data = dword ? x86::rax : x86::eax;
+            auto reg = dword ? x86::rdx : x86::edx;
+            auto mask = dword ? x86::r9 : x86::r9d;
+
+            load_gpr(x86::rdx, instr.target);
+            emit_address(instr);
+            builder->mov(x86::r8d, x86::ecx);
+            builder->and_(x86::r8d, size - 1);
+            builder->shl(x86::r8d, 3);
+            builder->and_(x86::ecx, ~(size - 1));
+
+            /* Everything happens between the access and the resume point, so the slow
+               path only has to run the interpreter. Stores are read-modify-write */
+            emit_fastmem(instr, 1, [&](const asmjit::Label& slow)
+            {
+                builder->mov(data, dword ? x86::qword_ptr(x86::r15, x86::rcx) : x86::dword_ptr(x86::r15, x86::rcx));
+                if (store)
+                    builder->mov(x86::r10d, x86::ecx);
+                else
+                    builder->mov(x86::r11, x86::rdx);
+
+                if (!store && left)
+                {
+                    /* LWL/LDL: data << (top - offset) | rt & (ones >> 8 >> offset) */
+                    builder->mov(x86::ecx, top);
+                    builder->sub(x86::ecx, x86::r8d);
+                    builder->shl(data, x86::cl);
+                    builder->mov(mask, ones >> 8);
+                    builder->mov(x86::ecx, x86::r8d);
+                    builder->shr(mask, x86::cl);
+                }
+                else if (!store)
+                {
+                    /* LWR/LDR: data >> offset | rt & ~(ones >> offset) */
+                    builder->mov(x86::ecx, x86::r8d);
+                    builder->shr(data, x86::cl);
+                    builder->mov(mask, ones);
+                    builder->shr(mask, x86::cl);
+                    builder->not_(mask);
+                }
+                else if (left)
+                {
+                    /* SWL/SDL: rt >> (top - offset) | data & (ones << 8 << offset) */
+                    builder->mov(x86::ecx, top);
+                    builder->sub(x86::ecx, x86::r8d);
+                    builder->shr(reg, x86::cl);
+                    builder->mov(mask, (ones << 8) & ones);
+                    builder->mov(x86::ecx, x86::r8d);
+                    builder->shl(mask, x86::cl);
+                }
+                else
+                {
+                    /* SWR/SDR: rt << offset | data & ~(ones << offset) */
+                    builder->mov(x86::ecx, x86::r8d);
+                    builder->shl(reg, x86::cl);
+                    builder->mov(mask, ones);
+                    builder->shl(mask, x86::cl);
+                    builder->not_(mask);
+                }
+
+                if (store)
+                {
+                    builder->and_(data, mask);
+                    builder->or_(data, reg);
+
+                    /* A write protected code page only faults here */
+                    auto site = builder->newLabel();
+                    builder->bind(site);
+                    size_t start = builder->offset();
+                    builder->mov(dword ? x86::qword_ptr(x86::r15, x86::r10) : x86::dword_ptr(x86::r15, x86::r10), data);
+                    while (builder->offset() - start < 5)
+                        builder->nop();
+
+                    fastmem_labels.emplace_back(site, slow);
+                    return;
+                }
+
+                builder->and_(reg, mask);
+                builder->or_(data, reg);
+
+                /* LWL always sign extends. LWR only does when it loads the whole
+                   word, otherwise the upper half of the register stays */
+                if (instr.operation == IROperation::LoadWordLeft)
+                {
+                    builder->movsxd(x86::rax, x86::eax);
+                }
+                else if (instr.operation == IROperation::LoadWordRight)
+                {
+                    builder->mov(x86::r9, 0xFFFFFFFF00000000ull);
+                    builder->and_(x86::r11, x86::r9);
+                    builder->or_(x86::r11, x86::rax);
+                    builder->movsxd(x86::rax, x86::eax);
+                    builder->test(x86::r8d, x86::r8d);
+                    builder->cmovne(x86::rax, x86::r11);
+                }
+            });
+
+            if (!store && instr.target != 0)
+                store_gpr(instr.target, x86::rax);
+        }
+
+        void JITCompiler::load_qword(const x86::Xmm& reg, uint16_t gpr)
+        {
+            /* Same as load_gpr, GPR[0] in memory can't be trusted */
+            if (gpr == 0)
+                builder->pxor(reg, reg);
+            else
+                builder->movdqu(reg, x86::xmmword_ptr(x86::rbx, offsetof(EmotionEngine, gpr) + gpr * sizeof(Register)));
+        }
+
+        void JITCompiler::store_qword(uint16_t gpr, const x86::Xmm& reg)
+        {
+            builder->movdqu(x86::xmmword_ptr(x86::rbx, offsetof(EmotionEngine, gpr) + gpr * sizeof(Register)), reg);
+        }
+
+        void JITCompiler::load_vu0_regs()
+        {
+            /* The vector units live as long as the emulator, so their address is fixed */
+            builder->mov(x86::rdx, reinterpret_cast<uint64_t>(&ee->emulator->vu[0]->regs));
+        }
+
+        void JITCompiler::emit_parallel(IRInstruction& instr)
+        {
+            uint16_t dest = instr.destination;
+            if (dest == 0)
+                return;
+
+            /* PADDUW relies on SSE4.1 for unsigned minimums */
+            bool sse41 = asmjit::CpuInfo::host().features().x86().hasSSE4_1();
+            if (instr.operation == IROperation::ParallelAddUnsignedSatWord && !sse41)
+            {
+                emit_fallback(instr);
+                return;
+            }
+
+            /* PLZCW only works on the lower two words, so do it with scalar code */
+            if (instr.operation == IROperation::ParallelLeadingZeroWord)
+            {
+                for (int i = 0; i < 2; i++)
+                {
+                    auto word = x86::dword_ptr(x86::rbx, offsetof(EmotionEngine, gpr) + instr.source * sizeof(Register) + i * 4);
+                    if (instr.source == 0)
+                        builder->xor_(x86::eax, x86::eax);
+                    else
+                        builder->mov(x86::eax, word);
+
+                    /* Leading sign bits minus one are the leading zeros of the
+                       inverted negative values. Shifting in a one bit
+                       subtracts that one and keeps bsr away from zero */
+                    builder->mov(x86::ecx, x86::eax);
+                    builder->sar(x86::ecx, 31);
+                    builder->xor_(x86::eax, x86::ecx);
+                    builder->lea(x86::eax, x86::ptr(1, x86::rax, 1));
+                    builder->bsr(x86::eax, x86::eax);
+                    builder->xor_(x86::eax, 31);
+                    builder->mov(x86::dword_ptr(x86::rbx, offsetof(EmotionEngine, gpr) + dest * sizeof(Register) + i * 4), x86::eax);
+                }
+                return;
+            }
+
+            load_qword(x86::xmm0, instr.source);
+            load_qword(x86::xmm1, instr.target);
+            switch (instr.operation)
+            {
+            case IROperation::ParallelAnd:
+                builder->pand(x86::xmm0, x86::xmm1);
+                break;
+            case IROperation::ParallelOr:
+                builder->por(x86::xmm0, x86::xmm1);
+                break;
+            case IROperation::ParallelXor:
+                builder->pxor(x86::xmm0, x86::xmm1);
+                break;
+            case IROperation::ParallelNor:
+                builder->por(x86::xmm0, x86::xmm1);
+                builder->pcmpeqd(x86::xmm1, x86::xmm1);
+                builder->pxor(x86::xmm0, x86::xmm1);
+                break;
+            case IROperation::ParallelSubByte:
+                builder->psubb(x86::xmm0, x86::xmm1);
+                break;
+            case IROperation::ParallelSubWord:
+                builder->psubd(x86::xmm0, x86::xmm1);
+                break;
+            case IROperation::ParallelAddUnsignedSatWord:
+                /* rs + rt saturates to rt + min(rs, ~rt) */
+                builder->pcmpeqd(x86::xmm2, x86::xmm2);
+                builder->pxor(x86::xmm2, x86::xmm1);
+                builder->pminud(x86::xmm0, x86::xmm2);
+                builder->paddd(x86::xmm0, x86::xmm1);
+                break;
+            case IROperation::ParallelCopyLowerDword:
+                /* rd = rs.lo : rt.lo */
+                builder->punpcklqdq(x86::xmm1, x86::xmm0);
+                builder->movdqa(x86::xmm0, x86::xmm1);
+                break;
+            case IROperation::ParallelCopyUpperDword:
+                /* rd = rt.hi : rs.hi */
+                builder->punpckhqdq(x86::xmm0, x86::xmm1);
+                break;
+            case IROperation::ParallelCopyHalfWord:
+                builder->pshuflw(x86::xmm0, x86::xmm1, 0);
+                builder->pshufhw(x86::xmm0, x86::xmm0, 0);
+                break;
+            default:
+                break;
+            }
+
+            store_qword(dest, x86::xmm0);
+        }
+
+        void JITCompiler::emit_cop1_move(IRInstruction& instr)
+        {
+            uint16_t fs = instr.destination;
+            uint16_t rt = instr.target;
+
+            switch (instr.operation)
+            {
+            case IROperation::MoveToCop1:
+                load_gpr(x86::rax, rt);
+                builder->mov(fpr_ptr(fs), x86::eax);
+                break;
+            case IROperation::MoveControlToCop1:
+                /* Only FCR0 and FCR31 exist, the rest ignore writes */
+                if (fs == 0 || fs == 31)
+                {
+                    load_gpr(x86::rax, rt);
+                    builder->mov(fcr_ptr(fs), x86::eax);
+                }
+                break;
+            default:
+                /* And leave the GPR untouched when read */
+                if (rt != 0 && (fs == 0 || fs == 31))
+                {
+                    builder->movsxd(x86::rax, fcr_ptr(fs));
+                    store_gpr(rt, x86::rax);
+                }
+                break;
+            }
+        }
+
+        void JITCompiler::emit_float_clamp(const x86::Xmm& reg)
+        {
+            /* Viewed as integers, positive NaNs and infinities are above FLT_MAX as signed
+               values and negative ones are above -FLT_MAX as unsigned values. So two integer
+               minimums saturate both to the largest finite value with the same sign */
+            builder->mov(x86::eax, 0x7F7FFFFF);
+            builder->movd(x86::xmm7, x86::eax);
+            builder->pminsd(reg, x86::xmm7);
+            builder->mov(x86::eax, 0xFF7FFFFF);
+            builder->movd(x86::xmm7, x86::eax);
+            builder->pminud(reg, x86::xmm7);
+        }
+
+        void JITCompiler::emit_float(IRInstruction& instr)
+        {
+            /* Lockstep has to match the interpreter bit for bit */
+            FloatClamp mode = ee->backend == Backend::Lockstep ? FloatClamp::Full : float_clamp;
+
+            /* Clamping needs the SSE4.1 integer minimums */
+            bool clamp = mode != FloatClamp::None;
+            if (clamp && !asmjit::CpuInfo::host().features().x86().hasSSE4_1())
+            {
+                emit_fallback(instr);
+                return;
+            }
+
+            auto load = [&](const x86::Xmm& reg, const x86::Mem& src)
+            {
+                builder->movss(reg, src);
+                if (mode == FloatClamp::Full)
+                    emit_float_clamp(reg);
+            };
+
+            auto acc = x86::dword_ptr(x86::rbx, offsetof(EmotionEngine, cop1) + offsetof(COP1, acc));
+            uint16_t fs = instr.destination;
+            uint16_t ft = instr.target;
+            uint16_t fd = instr.shift;
+
+            load(x86::xmm0, fpr_ptr(fs));
+            load(x86::xmm1, fpr_ptr(ft));
+            switch (instr.operation)
+            {
+            case IROperation::FloatAddAccumulator:
+                /* ACC = fs + ft */
+                builder->addss(x86::xmm0, x86::xmm1);
+                if (clamp)
+                    emit_float_clamp(x86::xmm0);
+                builder->movss(acc, x86::xmm0);
+                break;
+            default:
+                /* fd = ACC + fs * ft */
+                load(x86::xmm2, acc);
+                builder->mulss(x86::xmm0, x86::xmm1);
+                if (mode == FloatClamp::Full)
+                    emit_float_clamp(x86::xmm0);
+                builder->addss(x86::xmm0, x86::xmm2);
+                if (clamp)
+                    emit_float_clamp(x86::xmm0);
+                builder->movss(fpr_ptr(fd), x86::xmm0);
+                break;
+            }
+        }
+
+        void JITCompiler::emit_cop2_move(IRInstruction& instr)
+        {
+            /* rd names the VU0 register, rt the GPR */
+            uint16_t rt = instr.target;
+            uint16_t id = instr.destination;
+
+            load_vu0_regs();
+            switch (instr.operation)
+            {
+            case IROperation::MoveToCop2:
+                load_qword(x86::xmm0, rt);
+                builder->movdqa(vf_ptr(id), x86::xmm0);
+                break;
+            case IROperation::MoveFromCop2:
+                if (rt != 0)
+                {
+                    builder->movdqa(x86::xmm0, vf_ptr(id));
+                    store_qword(rt, x86::xmm0);
+                }
+                break;
+            case IROperation::MoveControlToCop2:
+                load_gpr(x86::rax, rt);
+                builder->mov(vi_ptr(id), x86::eax);
+                break;
+            default:
+                if (rt != 0)
+                {
+                    builder->movsxd(x86::rax, vi_ptr(id));
+                    store_gpr(rt, x86::rax);
+                }
+                break;
+            }
+        }
+
+        void JITCompiler::emit_vector(IRInstruction& instr)
+        {
+            /* The dest field has X in its top bit, blendps wants it in the lowest one */
+            vu::VUInstr vu_instr = { .value = instr.value };
+            uint32_t dest = vu_instr.dest;
+            uint8_t blend = ((dest >> 3) & 1) | ((dest >> 1) & 2) | ((dest << 1) & 4) | ((dest << 3) & 8);
+            if (blend != 0xf && !asmjit::CpuInfo::host().features().x86().hasSSE4_1())
+            {
+                emit_fallback(instr);
+                return;
+            }
+
+            auto vu0 = ee->emulator->vu[0].get();
+            auto acc = x86::xmmword_ptr(x86::rdx, reinterpret_cast<uint8_t*>(&vu0->acc) -
+                                                  reinterpret_cast<uint8_t*>(&vu0->regs));
+
+            load_vu0_regs();
+            builder->movaps(x86::xmm0, vf_ptr(vu_instr.fs));
+            switch (instr.operation)
+            {
+            case IROperation::VectorAdd:
+                builder->addps(x86::xmm0, vf_ptr(vu_instr.ft));
+                break;
+            case IROperation::VectorSub:
+            case IROperation::VectorSubAccumulator:
+                builder->subps(x86::xmm0, vf_ptr(vu_instr.ft));
+                break;
+            case IROperation::VectorMulAddAccumulator:
+                /* ACC += fs * ft */
+                builder->mulps(x86::xmm0, vf_ptr(vu_instr.ft));
+                builder->addps(x86::xmm0, acc);
+                break;
+            default:
+                /* ACC -= fs * ft */
+                builder->mulps(x86::xmm0, vf_ptr(vu_instr.ft));
+                builder->movaps(x86::xmm1, acc);
+                builder->subps(x86::xmm1, x86::xmm0);
+                builder->movaps(x86::xmm0, x86::xmm1);
+                break;
+            }
+
+            /* Only the fields in the dest mask are written */
+            bool to_acc = instr.operation != IROperation::VectorAdd && instr.operation != IROperation::VectorSub;
+            auto result = to_acc ? acc : vf_ptr(vu_instr.fd);
+            if (blend != 0xf)
+            {
+                builder->movaps(x86::xmm1, result);
+                builder->blendps(x86::xmm1, x86::xmm0, blend);
+                builder->movaps(x86::xmm0, x86::xmm1);
+            }
+
+            builder->movaps(result, x86::xmm0);
+        }
+
+        void JITCompiler::emit_branch(IRInstruction& instr, const asmjit::Label& epilogue)
+        {
+            auto pc_ptr = x86::dword_ptr(x86::rbx, offsetof(EmotionEngine, pc));
+            uint32_t link = instr.pc + 8;
+
+            /* Jumps only have to store the target. Links are zero extended like in the interpreter */
+            if (instr.operation == IROperation::Jump || instr.operation == IROperation::JumpLink)
+            {
+                if (instr.immediate_data)
+                {
+                    builder->mov(pc_ptr, ((instr.pc + 4) & 0xF0000000) | (instr.immediate << 2));
+                }
+                else
+                {
+                    /* Read the target first, jalr may link to the same register */
+                    load_gpr(x86::rax, instr.source);
+                    builder->mov(pc_ptr, x86::eax);
+                }
+
+                uint16_t link_gpr = instr.immediate_data ? 31 : instr.destination;
+                if (instr.operation == IROperation::JumpLink && link_gpr != 0)
+                {
+                    builder->mov(x86::eax, link);
+                    store_gpr(link_gpr, x86::rax);
+                }
+
+                return;
+            }
+
+            /* beq and bne compare two registers, the rest compare rs with zero */
+            load_gpr(x86::rax, instr.source);
+            if (instr.condition == BranchCond::Equal || instr.condition == BranchCond::NotEqual)
+            {
+                load_gpr(x86::rcx, instr.target);
+                builder->cmp(x86::rax, x86::rcx);
+            }
+            else
+            {
+                builder->test(x86::rax, x86::rax);
+            }
+
+            /* Pick the next PC now, as the delay slot might overwrite the operands */
+            int32_t offset = (int16_t)instr.immediate << 2;
+            builder->mov(x86::ecx, link);
+            builder->mov(x86::edx, instr.pc + 4 + offset);
+
+            x86::CondCode taken;
+            switch (instr.condition)
+            {
+            case BranchCond::Equal: taken = x86::CondCode::kEqual; break;
+            case BranchCond::NotEqual: taken = x86::CondCode::kNotEqual; break;
+            case BranchCond::LessThan: taken = x86::CondCode::kSignedLT; break;
+            case BranchCond::LessThanOrEqual: taken = x86::CondCode::kSignedLE; break;
+            case BranchCond::GreaterThan: taken = x86::CondCode::kSignedGT; break;
+            default: taken = x86::CondCode::kSignedGE; break;
+            }
+
+            builder->cmov(taken, x86::ecx, x86::edx);
+            builder->mov(pc_ptr, x86::ecx);
+            if (instr.operation == IROperation::Branch)
+                return;
+
+            /* A likely branch that isn't taken skips its delay slot and leaves right away */
+            auto not_taken = builder->newLabel();
+            builder->j(x86::negateCond(taken), not_taken);
+
+            builder->section(cold);
+            builder->bind(not_taken);
+            allocator.writeback(builder);
+            builder->jmp(epilogue);
+            builder->section(code->textSection());
+        }
+
+        void JITCompiler::emit_fallback(IRInstruction& instr)
+        {
+            /* The interpreter functions were written to not depend too much on internal
+             * state, so we only need to update the instr to make sure branches read correct
+             * values
+             */
+             auto instr_pc_ptr = x86::dword_ptr(x86::rbx,
+                                            offsetof(EmotionEngine, instr) +
+                                            offsetof(Instruction, pc));
+             auto instr_value_ptr = x86::dword_ptr(x86::rbx,
+                                            offsetof(EmotionEngine, instr) +
+                                            offsetof(Instruction, value));
+
+             builder->mov(instr_pc_ptr, instr.pc);
+             builder->mov(instr_value_ptr, instr.value);
+
+             builder->mov(x86::rdi, x86::rbx);
+             builder->call(reinterpret_cast<uint64_t>(instr.handler));
+
+             /* Sometimes an instruction might write to GPR[0].
+                To avoid branches, reset the register each time */
+             //builder->mov(x86::qqword_ptr(x86::rdi, offsetof(EmotionEngine, gpr[0])), 0);
+        }
+
+        /* Look up the block cache for the block */
+        BlockFunc lookup_next_block(EmotionEngine* ee)
+		{
+            uint32_t pc = ee->pc;
+
+            JITCompiler* compiler = ee->compiler;
+            //fmt::print("[JIT] Searching for block at PC: {:#x}\n", pc);
+
+            /* Pick up what the worker compiled in the meantime */
+            if (compiler->compile_queue.finished()) [[unlikely]]
+                compiler->install_compiled();
+
+            /* Virtual aliases of the same code share a slot, so make sure it's ours */
+            uint32_t paddr = pc & common::KUSEG_MASKS[pc >> 29];
+            if (auto block = compiler->block_table.find(paddr); block && block->pc == pc) [[likely]]
+                return block->code;
+
+            /* Only the JIT backend compiles in the background. The others emit
+               right here, which needs the emitter back from the worker */
+            bool background = compiler->compile_queue.running() && compiler->tier_threshold &&
+                              ee->backend == Backend::JIT;
+            if (!background && compiler->compile_queue.running()) [[unlikely]]
+                compiler->drain_compile_queue();
+
+            Block* block = nullptr;
+            if (auto result = compiler->block_cache.find(pc); result == compiler->block_cache.end())
+            {
+                auto start = std::chrono::steady_clock::now();
+                IRBlock ir_block(pc);
+                bool decoded = false, optimized = false;
+
+                /* New code starts out interpreted and gets compiled once it proves hot */
+                if (compiler->tier_threshold && ee->backend == Backend::JIT)
+                {
+                    auto cold = compiler->cold_blocks.find(pc);
+                    if (cold == compiler->cold_blocks.end())
+                    {
+                        /* Only hot blocks make it to the IR cache, so code that was hot
+                           in a previous run is compiled right away, in the background or here */
+                        optimized = compiler->ir_cache.lookup(ee, pc, ir_block);
+                        if (!optimized || background)
+                        {
+                            /* Tier 0 runs the unoptimized IR */
+                            IRBlock ir = compiler->irbuilder.generate(pc);
+                            compiler->track_pages(pc, ir.ranges);
+                            auto& cold_block = compiler->cold_blocks.emplace(pc, ColdBlock{ std::move(ir) }).first->second;
+                            if (optimized)
+                            {
+                                auto profile = compiler->profiler.enabled() ? compiler->profiler.profile(pc) : nullptr;
+                                cold_block.job = compiler->compile_queue.push(std::move(ir_block), profile, true);
+                            }
+
+                            return run_cold_block;
+                        }
+                    }
+                    else
+                    {
+                        if (cold->second.executions < compiler->tier_threshold || cold->second.job)
+                            return run_cold_block;
+
+                        /* Keep interpreting it until the worker is done with a copy of the IR */
+                        if (background)
+                        {
+                            auto profile = compiler->profiler.enabled() ? compiler->profiler.profile(pc) : nullptr;
+                            cold->second.job = compiler->compile_queue.push(IRBlock(cold->second.ir), profile);
+                            return run_cold_block;
+                        }
+
+                        /* Promote it, the IR is already there */
+                        ir_block = std::move(cold->second.ir);
+                        decoded = true;
+                        compiler->untrack_pages(pc, ir_block.ranges);
+                        compiler->cold_blocks.erase(cold);
+                    }
+                }
+
+                /* Compile the block. Decoding can be skipped if
+                   the same code was seen in a previous run */
+                if (!decoded && !optimized)
+                    optimized = compiler->ir_cache.lookup(ee, pc, ir_block);
+
+                if (!optimized)
+                {
+                    if (!decoded)
+                        ir_block = compiler->irbuilder.generate(pc);
+
+                    optimizer::optimize(ir_block);
+                    compiler->ir_cache.store(ee, ir_block);
+                }
+
+                /* Emitting might flush the cache, so insert the block afterwards */
+                Block native = compiler->emit_native(ir_block);
+                block = &(compiler->block_cache[pc] = std::move(native));
+
+                if (compiler->profiler.enabled())
+                {
+                    auto latency = std::chrono::steady_clock::now() - start;
+                    compiler->profiler.profile(pc)->compile_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count();
+                }
+
+                /* Lockstep has to see every block, so it doesn't chain them */
+                if (ee->backend != Backend::Lockstep)
+                    compiler->link_block(*block);
+                compiler->track_pages(block->pc, block->ranges);
+            }
+            else
+            {
+                block = &result->second;
+            }
+
+            compiler->block_table.insert(paddr, block);
+            return block->code;
+        }
+
+        void JITCompiler::install_compiled()
+        {
+            auto& job = *compile_queue.finished();
+            uint32_t pc = job.ir.pc;
+
+            /* Writes to the code while the worker was busy dropped the cold block,
+               so the result is only good if the block is still the one that was queued */
+            auto cold = cold_blocks.find(pc);
+            if (cold != cold_blocks.end() && cold->second.job == job.id && !cold->second.stale)
+            {
+                untrack_pages(pc, cold->second.ir.ranges);
+                cold_blocks.erase(cold);
+                if (!job.optimized)
+                    ir_cache.store(ee, job.ir);
+
+                /* Installing might flush the cache, so insert the block afterwards */
+                Block native = install_code(job.ir, job.profile);
+                auto& block = block_cache[pc] = std::move(native);
+
+                if (job.profile)
+                    job.profile->compile_ns += job.compile_ns;
+
+                if (ee->backend != Backend::Lockstep)
+                    link_block(block);
+                track_pages(block.pc, block.ranges);
+            }
+
+            compile_queue.release();
+        }
+
+        void JITCompiler::drain_compile_queue()
+        {
+            while (compile_queue.wait())
+                install_compiled();
+        }
+
+        void run_cold_block(EmotionEngine* ee)
+        {
+            JITCompiler* compiler = ee->compiler;
+            auto& cold = compiler->cold_blocks.find(ee->pc)->second;
+            auto& block = cold.ir;
+
+            /* Handlers can write to the code of the block, keep it alive until the end */
+            cold.executions++;
+            compiler->running_cold = &cold;
+
+            /* Mirrors the code emit_native would generate with every instruction as a fallback */
+            for (auto& instr : block.instructions)
+            {
+                if (instr.operation == IROperation::None)
+                    continue;
+
+                ee->instr.pc = instr.pc;
+                ee->instr.value = instr.value;
+                instr.handler(ee);
+                ee->gpr[0].qword = 0;
+
+                if (instr.operation == IROperation::ExceptionReturn ||
+                    instr.operation == IROperation::Syscall)
+                {
+                    ee->pc -= 4;
+                }
+
+                if (instr.operation == IROperation::BranchLikely && ee->skip_branch_delay)
+                {
+                    ee->skip_branch_delay = false;
+                    ee->pc -= 4;
+                    break;
+                }
+            }
+
+            ee->cycles_to_execute -= block.total_cycles;
+            if (ee->branch_taken)
+            {
+                ee->branch_taken = false;
+                if (block.idle_loop)
+                    ee->cycles_to_execute = 0;
+            }
+            else if (!block.instructions.back().is_direct)
+            {
+                /* SYSCALL leaves the PC at the exception handler */
+                ee->pc = block.end;
+            }
+
+            compiler->running_cold = nullptr;
+            if (cold.stale)
+                compiler->cold_blocks.erase(block.pc);
+        }
+
+        void JITCompiler::run()
+        {
+            uint64_t start = profiler.enabled() ? __rdtsc() : 0;
+
+            if (ee->backend == Backend::Lockstep)
+                lockstep.run();
+            else
+                entry(ee);
+
+            if (profiler.enabled())
+            {
+                profiler.add_run_time(__rdtsc() - start);
+                profiler.poll();
+            }
+        }
+
+        /* This function is responsible for emitting a dispatcher
+           that attempts to find and directly execute the next
+           block in the instruction stream. */
+        void JITCompiler::emit_block_dispatcher()
+        {
+            asmjit::Label loop_start = builder->newLabel();
+            asmjit::Label bios = builder->newLabel();
+            asmjit::Label probe_page = builder->newLabel();
+            asmjit::Label miss = builder->newLabel();
+            asmjit::Label run = builder->newLabel();
+
+            /*  do
+                {
+                    BlockFunc block = block_table.find(paddr);
+                    if (!block || compile_queue.finished())
+                        block = lookup_next_block(ee);
+                    block(ee);
+                } while (ee->cycles_to_execute > 0);
+            */
+
+            auto cycles_ptr = x86::dword_ptr(x86::rbx, offsetof(EmotionEngine, cycles_to_execute));
+            auto pc_ptr = x86::dword_ptr(x86::rbx, offsetof(EmotionEngine, pc));
+
+            /* Blocks keep the EE in rbx, guest registers in r12-r14
+               and the fastmem base in r15 */
+            emit_register_flush();
+            builder->mov(x86::rbx, x86::rdi);
+            builder->mov(x86::r15, reinterpret_cast<uint64_t>(fastmem.base));
+            builder->bind(loop_start);
+
+            /* Finished background compiles are installed by lookup_next_block */
+            builder->mov(x86::rcx, reinterpret_cast<uint64_t>(compile_queue.ready_flag()));
+            builder->cmp(x86::byte_ptr(x86::rcx), 0);
+            builder->jne(miss);
+
+            /* Translate the PC, eax = pc and edx = paddr */
+            builder->mov(x86::eax, pc_ptr);
+            builder->mov(x86::ecx, x86::eax);
+            builder->shr(x86::ecx, 29);
+            builder->mov(x86::rdx, reinterpret_cast<uint64_t>(common::KUSEG_MASKS));
+            builder->mov(x86::edx, x86::dword_ptr(x86::rdx, x86::rcx, 2));
+            builder->and_(x86::edx, x86::eax);
+
+            /* Pick the first level table, scratchpad code takes the slow path */
+            builder->cmp(x86::edx, BlockTable::RAM_SIZE);
+            builder->jae(bios);
+            builder->mov(x86::ecx, x86::edx);
+            builder->mov(x86::r8, reinterpret_cast<uint64_t>(block_table.ram_pages()));
+            builder->jmp(probe_page);
+
+            builder->bind(bios);
+            builder->lea(x86::ecx, x86::ptr(x86::rdx, -(int32_t)BlockTable::BIOS_START));
+            builder->cmp(x86::ecx, BlockTable::BIOS_SIZE);
+            builder->jae(miss);
+            builder->mov(x86::r8, reinterpret_cast<uint64_t>(block_table.bios_pages()));
+
+            /* Page, then the slot of the instruction. Virtual aliases share
+               a slot, so the block also has to start at our PC */
+            builder->bind(probe_page);
+            builder->shr(x86::ecx, BlockTable::PAGE_SHIFT);
+            builder->mov(x86::r8, x86::qword_ptr(x86::r8, x86::rcx, 3));
+            builder->test(x86::r8, x86::r8);
+            builder->jz(miss);
+            builder->and_(x86::edx, BlockTable::PAGE_MASK & ~3);
+            builder->mov(x86::r8, x86::qword_ptr(x86::r8, x86::rdx, 1));
+            builder->test(x86::r8, x86::r8);
+            builder->jz(miss);
+            builder->cmp(x86::dword_ptr(x86::r8, offsetof(Block, pc)), x86::eax);
+            builder->jne(miss);
+            builder->mov(x86::rax, x86::qword_ptr(x86::r8, offsetof(Block, code)));
+            builder->jmp(run);
+
+            /* Compiles, promotes and installs blocks */
+            builder->bind(miss);
+            builder->mov(x86::rdi, x86::rbx);
+            builder->call(reinterpret_cast<uint64_t>(lookup_next_block));
+
+            builder->bind(run);
+            builder->mov(x86::rdi, x86::rbx);
+            builder->call(x86::rax);
+
+            builder->cmp(cycles_ptr, 0);
+            builder->jg(loop_start);
+            emit_register_restore();
+            builder->ret();
+        }
+
+        void JITCompiler::emit_block_trampoline()
+        {
+            /* void trampoline(EmotionEngine* ee, BlockFunc block) */
+            emit_register_flush();
+            builder->mov(x86::rbx, x86::rdi);
+            builder->mov(x86::r15, reinterpret_cast<uint64_t>(fastmem.base));
+            builder->call(x86::rsi);
+            emit_register_restore();
             builder->ret();
         }
 	}
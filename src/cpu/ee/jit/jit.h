@@ -1,7 +1,19 @@
 #pragma once
 #include <cpu/ee/jit/ir.h>
+#include <cpu/ee/jit/regalloc.h>
+#include <cpu/ee/jit/codecache.h>
+#include <cpu/ee/jit/fastmem.h>
+#include <cpu/ee/jit/blocktable.h>
+#include <cpu/ee/jit/ircache.h>
+#include <cpu/ee/jit/lockstep.h>
+#include <cpu/ee/jit/profiler.h>
+#include <cpu/ee/jit/perfmap.h>
+#include <cpu/ee/jit/compilequeue.h>
 #include <asmjit/asmjit.h>
 #include <robin_hood.h>
+#include <memory>
+#include <vector>
+#include <bitset>
 
 namespace ee
 {
@@ -12,9 +24,80 @@ namespace ee
 		struct JITCompiler;
         using BlockFunc = void(*)(EmotionEngine*);
 
+        /* A block exit with a statically known target. The exit ends with a
+           jmp rel32 that is patched to enter the successor directly */
+        struct BlockLink
+        {
+            uint32_t target;
+            uint8_t* jump;
+        };
+
+        /* The R5900 FPU has no NaNs or infinities, overflows saturate to +-FLT_MAX instead.
+           None: use the host results as is
+           Results: clamp every value written to an FPR or the accumulator
+           Full: clamp the operands and intermediate products as well, same as the
+           interpreter. The lockstep backend always uses this one */
+        enum class FloatClamp
+        {
+            None,
+            Results,
+            Full
+        };
+
+        /* A compiled block along with the exits it can be chained through */
+        struct Block
+        {
+            BlockFunc code = nullptr;
+            uint32_t pc = 0, end = 0;
+            std::vector<IRRange> ranges;
+            std::vector<BlockLink> exits;
+
+            /* The IR the code was emitted from, only kept for the lockstep report */
+            std::shared_ptr<const std::vector<IRInstruction>> ir;
+        };
+
+        /* Shadow stack of the return addresses of JAL/JALR, so a jr $ra can enter the
+           block it returns to without going through the dispatcher. The code of an entry
+           is a linkable exit of the calling block, which leads to the block at the PC once
+           it's compiled and back to the dispatcher otherwise. Deep call chains wrap around */
+        struct ReturnStack
+        {
+            struct Entry
+            {
+                /* Misaligned, so an empty entry never matches */
+                uint32_t pc = 1;
+                uint8_t* code = nullptr;
+            };
+
+            static constexpr uint32_t SIZE = 16;
+            Entry entries[SIZE];
+            uint32_t top = 0;
+        };
+
+        /* Returns the compiled block at the EE PC, compiling it if needed */
+        BlockFunc lookup_next_block(EmotionEngine* ee);
+
+        /* Tier 0, runs the decoded block at the EE PC through the interpreter handlers */
+        void run_cold_block(EmotionEngine* ee);
+
+        /* A block that hasn't run often enough to be compiled yet */
+        struct ColdBlock
+        {
+            IRBlock ir;
+            uint32_t executions = 0;
+
+            /* Invalidated while running, dropped once it returns */
+            bool stale = false;
+
+            /* Id of the background compile of the block, zero if it isn't queued */
+            uint32_t job = 0;
+        };
+
 		struct JITCompiler
 		{
             friend BlockFunc lookup_next_block(EmotionEngine* compiler);
+            friend void run_cold_block(EmotionEngine* ee);
+            friend struct Lockstep;
 
 			JITCompiler(EmotionEngine* parent);
 			~JITCompiler();
@@ -22,15 +105,94 @@ namespace ee
             void run();
 			void reset();
 
+            /* Drop the block at the address and unchain everything jumping to it */
+            void invalidate(uint32_t pc);
+
+            /* Evict the blocks translated from the RAM page of the physical address */
+            void invalidate_page(uint32_t paddr);
+
+            /* Throw away every compiled block */
+            void flush();
+
+            /* Redirect a faulting fastmem access to its slow path. Returns
+               false if the fault didn't come from a fastmem access */
+            bool handle_fault(uint8_t*& rip, void* address);
+
+            /* EE RAM is tracked for code in 4KB pages */
+            static constexpr uint32_t PAGE_SHIFT = 12;
+            static constexpr uint32_t RAM_PAGES = (32 * 1024 * 1024) >> PAGE_SHIFT;
+
         private:
-            BlockFunc emit_native(IRBlock& block);
+            /* Assembles the block into the emitter and copies it to the code cache */
+            Block emit_native(IRBlock& block);
+            void emit_code(IRBlock& block, BlockProfile* profile);
+            Block install_code(IRBlock& block, BlockProfile* profile);
+
+            /* Put the block the worker finished in place of its cold block */
+            void install_compiled();
+
+            /* Install everything the worker has left, so this thread can use the emitter */
+            void drain_compile_queue();
             void emit_block_dispatcher();
+            void emit_block_trampoline();
+
+            /* Block linking */
+            void emit_link(uint32_t target, const asmjit::Label& exit);
+            void emit_return_push(uint32_t link);
+            void emit_return_predict(const asmjit::Label& exit);
+            void link_block(Block& block);
+            static bool patch_jump(uint8_t* jump, BlockFunc target);
+
+            /* Returns the range of RAM pages the code between the addresses lives in */
+            static bool block_pages(uint32_t pc, uint32_t end, uint32_t& first, uint32_t& last);
+            void track_pages(uint32_t pc, const std::vector<IRRange>& ranges);
+            void untrack_pages(uint32_t pc, const std::vector<IRRange>& ranges);
 
             void emit_register_flush();
             void emit_register_restore();
 
+            /* Access guest GPRs from native code */
+            void load_gpr(const asmjit::x86::Gp& reg, uint16_t gpr);
+            void store_gpr(uint16_t gpr, const asmjit::x86::Gp& reg);
+            void load_qword(const asmjit::x86::Xmm& reg, uint16_t gpr);
+            void store_qword(uint16_t gpr, const asmjit::x86::Xmm& reg);
+
+            /* Points rdx to the registers of VU0, for vf_ptr and friends */
+            void load_vu0_regs();
+
             /* Native implementations of IR instructions */
+            void emit_arithmetic(IRInstruction& instr);
+            void emit_logic(IRInstruction& instr);
+            void emit_set_less_than(IRInstruction& instr);
+            void emit_shift(IRInstruction& instr);
+            void emit_load_immediate(IRInstruction& instr);
+            void emit_move(IRInstruction& instr);
+            void emit_multiply(IRInstruction& instr);
+            void emit_divide(IRInstruction& instr);
+            void emit_hilo_move(IRInstruction& instr);
+            void emit_load(IRInstruction& instr);
+            void emit_store(IRInstruction& instr);
+            void emit_parallel(IRInstruction& instr);
+            void emit_cop1_move(IRInstruction& instr);
+            void emit_float(IRInstruction& instr);
+            void emit_float_clamp(const asmjit::x86::Xmm& reg);
+            void emit_cop2_move(IRInstruction& instr);
+            void emit_vector(IRInstruction& instr);
             void emit_fallback(IRInstruction& instr);
+            void emit_branch(IRInstruction& instr, const asmjit::Label& epilogue);
+
+            /* Guest memory accesses through the fastmem window */
+            void emit_address(IRInstruction& instr);
+            template <typename Func>
+            void emit_fastmem(IRInstruction& instr, int size, Func&& access);
+
+            /* Calls the device handler of a constant MMIO address directly. Returns
+               false if the access has to take the regular path */
+            bool emit_mmio(IRInstruction& instr, int size, bool store);
+
+            /* LQ/SQ/LQC2/SQC2 and the LWL/LWR/SWL/SWR/LDL/LDR/SDL/SDR family */
+            void emit_qword_access(IRInstruction& instr);
+            void emit_unaligned(IRInstruction& instr);
 
         private:
 			/* Emitter */
@@ -45,12 +207,89 @@ namespace ee
 			/* Transition from host -> JIT */
             BlockFunc entry;
 
+            /* Runs a single block with the same setup as the dispatcher */
+            using TrampolineFunc = void(*)(EmotionEngine*, BlockFunc);
+            TrampolineFunc trampoline;
+
             /* Builds IR code that the JIT can convert to native */
             IRBuilder irbuilder;
 
+            /* Compiles promoted tier 0 blocks off the emulation thread */
+            CompileQueue compile_queue;
+
+            /* Checks every block against the interpreter in the lockstep backend */
+            Lockstep lockstep{ this, ee };
+
+            /* Caches guest GPRs in host registers for the block being emitted */
+            RegisterAllocator allocator;
+
+            /* Linkable exits of the block being emitted */
+            std::vector<std::pair<uint32_t, asmjit::Label>> exit_labels;
+
+            /* Every linkable exit grouped by its target address, so
+               blocks can be chained and unchained when the target changes */
+            robin_hood::unordered_flat_map<uint32_t, std::vector<uint8_t*>> links;
+
+            /* Only touched by JIT code. Entries point into the code of their calling
+               block, so the stack is cleared whenever a block goes away */
+            ReturnStack return_stack;
+
+            /* Blocks that are still interpreted, keyed by their virtual PC */
+            robin_hood::unordered_node_map<uint32_t, ColdBlock> cold_blocks;
+            ColdBlock* running_cold = nullptr;
+
+            /* Reverse index of the blocks translated from each RAM page */
+            robin_hood::unordered_flat_map<uint32_t, std::vector<uint32_t>> page_blocks;
+
+            /* Compiled blocks live here. Invalidated code stays in
+               place until the next flush, so a block can safely
+               invalidate itself while it's running */
+            static constexpr size_t CODE_CACHE_SIZE = 64 * 1024 * 1024;
+            CodeCache cache{ CODE_CACHE_SIZE };
+
+            /* Slow paths are kept out of line, away from the hot code */
+            asmjit::Section* cold = nullptr;
+
+            /* Fastmem accesses of the block being emitted and their slow paths */
+            std::vector<std::pair<asmjit::Label, asmjit::Label>> fastmem_labels;
+
+            /* Maps the host address of every fastmem access to its slow path */
+            robin_hood::unordered_flat_map<uint8_t*, uint8_t*> fastmem_sites;
+
         public:
-            /* Maps a PS2 address to a code block */
-            robin_hood::unordered_flat_map<uint32_t, BlockFunc> block_cache;
+            /* EE RAM and scratchpad along with their fastmem window */
+            Fastmem fastmem;
+
+            /* Owns the compiled blocks, keyed by their virtual PC */
+            robin_hood::unordered_node_map<uint32_t, Block> block_cache;
+
+            /* Fast path of the dispatcher, maps physical PCs to blocks */
+            BlockTable block_table;
+
+            /* RAM pages that have been translated. Checked by every EE RAM write */
+            std::bitset<RAM_PAGES> code_pages;
+
+            /* Decoded blocks saved from previous runs. Disabled until opened, the EE
+               opens the file named by the EE_IR_CACHE environment variable */
+            IRCache ir_cache;
+
+            /* Per block execution statistics. Disabled until enabled, the EE
+               enables it with the report path in the EE_JIT_PROFILE environment variable */
+            Profiler profiler;
+
+            /* Symbols of the JIT code for Linux perf. Enable before reset() to cover the dispatcher,
+               the EE does that when the EE_PERF_MAP environment variable is set */
+            PerfMap perf_map;
+
+            /* Number of tier 0 executions before a block gets compiled. Zero compiles on first use */
+            uint32_t tier_threshold = 16;
+
+            /* Compile promoted blocks on a worker thread, they stay in tier 0 until
+               the code is ready. Only used by the JIT backend, reset() after changing it */
+            bool background_compile = true;
+
+            /* Compiled blocks keep the mode they were emitted with, flush() after changing it */
+            FloatClamp float_clamp = FloatClamp::Results;
 		};
 	}
 }
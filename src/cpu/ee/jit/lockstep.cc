@@ -0,0 +1,279 @@
+#include <cpu/ee/jit/lockstep.h>
+#include <cpu/ee/jit/jit.h>
+#include <cpu/ee/ee.h>
+#include <cpu/vu/vu.h>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ee
+{
+	namespace jit
+	{
+        /* The guest visible CPU state a block can change */
+        struct CpuState
+        {
+            Register gpr[32];
+            uint32_t pc, sa;
+            uint64_t hi0, hi1, lo0, lo1;
+            COP0 cop0;
+            COP1 cop1;
+            Instruction instr, next_instr;
+
+            /* VU0 runs inside EE blocks in macro mode */
+            vu::Registers vu0;
+            vu::Vector acc;
+        };
+
+        static CpuState save_state(EmotionEngine* ee)
+        {
+            CpuState state;
+            std::copy(ee->gpr, ee->gpr + 32, state.gpr);
+            state.pc = ee->pc;
+            state.sa = ee->sa;
+            state.hi0 = ee->hi0;
+            state.hi1 = ee->hi1;
+            state.lo0 = ee->lo0;
+            state.lo1 = ee->lo1;
+            state.cop0 = ee->cop0;
+            state.cop1 = ee->cop1;
+            state.instr = ee->instr;
+            state.next_instr = ee->next_instr;
+            state.vu0 = ee->emulator->vu[0]->regs;
+            state.acc = ee->emulator->vu[0]->acc;
+            return state;
+        }
+
+        static void restore_state(EmotionEngine* ee, const CpuState& state)
+        {
+            std::copy(state.gpr, state.gpr + 32, ee->gpr);
+            ee->pc = state.pc;
+            ee->sa = state.sa;
+            ee->hi0 = state.hi0;
+            ee->hi1 = state.hi1;
+            ee->lo0 = state.lo0;
+            ee->lo1 = state.lo1;
+            ee->cop0 = state.cop0;
+            ee->cop1 = state.cop1;
+            ee->instr = state.instr;
+            ee->next_instr = state.next_instr;
+            ee->emulator->vu[0]->regs = state.vu0;
+            ee->emulator->vu[0]->acc = state.acc;
+        }
+
+        static void compare_state(const CpuState& expected, const CpuState& actual, std::vector<std::string>& diffs)
+        {
+            auto check = [&](const std::string& name, uint64_t interpreter, uint64_t jit)
+            {
+                if (interpreter != jit)
+                    diffs.push_back(fmt::format("{}: interpreter {:#x}, JIT {:#x}", name, interpreter, jit));
+            };
+
+            for (int i = 1; i < 32; i++)
+            {
+                check(fmt::format("gpr[{}].dword[0]", i), expected.gpr[i].dword[0], actual.gpr[i].dword[0]);
+                check(fmt::format("gpr[{}].dword[1]", i), expected.gpr[i].dword[1], actual.gpr[i].dword[1]);
+            }
+
+            check("pc", expected.pc, actual.pc);
+            check("sa", expected.sa, actual.sa);
+            check("hi0", expected.hi0, actual.hi0);
+            check("hi1", expected.hi1, actual.hi1);
+            check("lo0", expected.lo0, actual.lo0);
+            check("lo1", expected.lo1, actual.lo1);
+
+            for (int i = 0; i < 32; i++)
+            {
+                check(fmt::format("cop0[{}]", i), expected.cop0.regs[i], actual.cop0.regs[i]);
+                check(fmt::format("fpr[{}]", i), expected.cop1.fpr[i].uint, actual.cop1.fpr[i].uint);
+            }
+
+            check("acc", expected.cop1.acc.uint, actual.cop1.acc.uint);
+            check("fcr0", expected.cop1.fcr0.value, actual.cop1.fcr0.value);
+            check("fcr31", expected.cop1.fcr31.value, actual.cop1.fcr31.value);
+
+            for (int i = 0; i < 32; i++)
+            {
+                check(fmt::format("vf[{}].xy", i), (uint64_t)expected.vu0.vf[i].qword, (uint64_t)actual.vu0.vf[i].qword);
+                check(fmt::format("vf[{}].zw", i), (uint64_t)(expected.vu0.vf[i].qword >> 64),
+                      (uint64_t)(actual.vu0.vf[i].qword >> 64));
+            }
+
+            for (int i = 0; i < 16; i++)
+            {
+                check(fmt::format("vi[{}]", i), expected.vu0.vi[i], actual.vu0.vi[i]);
+                check(fmt::format("vu0 control[{}]", i), expected.vu0.control[i], actual.vu0.control[i]);
+            }
+
+            check("vu0 acc.xy", (uint64_t)expected.acc.qword, (uint64_t)actual.acc.qword);
+            check("vu0 acc.zw", (uint64_t)(expected.acc.qword >> 64), (uint64_t)(actual.acc.qword >> 64));
+        }
+
+        static void compare_writes(EmotionEngine* ee, const WriteJournal& interpreter, const WriteJournal& jit,
+                                   std::vector<std::string>& diffs)
+        {
+            /* Fastmem stores bypass the journal, so check the final memory
+               contents against what the interpreter wrote instead */
+            std::map<uint32_t, uint8_t> memory;
+            std::vector<const MemoryWrite*> expected_mmio, actual_mmio;
+            for (auto& write : interpreter.writes)
+            {
+                if (!ee->memory_ptr(write.paddr))
+                {
+                    expected_mmio.push_back(&write);
+                    continue;
+                }
+
+                for (uint32_t i = 0; i < write.size; i++)
+                    memory[write.paddr + i] = write.data[i];
+            }
+
+            for (auto [paddr, value] : memory)
+            {
+                uint8_t actual = *ee->memory_ptr(paddr);
+                if (actual != value)
+                    diffs.push_back(fmt::format("memory[{:#x}]: interpreter {:#x}, JIT {:#x}", paddr, value, actual));
+            }
+
+            /* The JIT journal has what every store overwrote, so a change the
+               interpreter didn't make is a stray write. MMIO writes are compared in order */
+            std::map<uint32_t, uint8_t> original;
+            for (auto& write : jit.writes)
+            {
+                if (!ee->memory_ptr(write.paddr))
+                {
+                    actual_mmio.push_back(&write);
+                    continue;
+                }
+
+                for (uint32_t i = 0; i < write.size; i++)
+                {
+                    if (!memory.count(write.paddr + i))
+                        original.emplace(write.paddr + i, write.old_data[i]);
+                }
+            }
+
+            for (auto [paddr, value] : original)
+            {
+                uint8_t actual = *ee->memory_ptr(paddr);
+                if (actual != value)
+                    diffs.push_back(fmt::format("memory[{:#x}]: only written by the JIT, {:#x} -> {:#x}", paddr, value, actual));
+            }
+
+            size_t count = std::max(expected_mmio.size(), actual_mmio.size());
+            for (size_t i = 0; i < count; i++)
+            {
+                auto expected = i < expected_mmio.size() ? expected_mmio[i] : nullptr;
+                auto actual = i < actual_mmio.size() ? actual_mmio[i] : nullptr;
+                if (expected && actual && expected->paddr == actual->paddr && expected->size == actual->size &&
+                    !std::memcmp(expected->data, actual->data, expected->size))
+                    continue;
+
+                auto describe = [](const MemoryWrite* write)
+                {
+                    if (!write)
+                        return std::string("nothing");
+
+                    uint64_t value = 0;
+                    std::memcpy(&value, write->data, std::min<uint32_t>(write->size, sizeof(value)));
+                    return fmt::format("{} bytes of {:#x} to {:#x}", write->size, value, write->paddr);
+                };
+
+                diffs.push_back(fmt::format("MMIO write {}: interpreter {}, JIT {}", i, describe(expected), describe(actual)));
+            }
+        }
+
+        Lockstep::Lockstep(JITCompiler* compiler, EmotionEngine* ee) :
+            compiler(compiler), ee(ee)
+        {
+        }
+
+        void Lockstep::interpret_block(uint32_t pc, const std::vector<IRRange>& ranges)
+        {
+            ee->pc = pc;
+            ee->fetch_next();
+
+            /* The interpreter follows the jumps between the ranges of a superblock
+               by itself. A likely branch that isn't taken skips over its delay slot */
+            uint32_t count = 0;
+            for (auto& range : ranges)
+                count += (range.end - range.pc) / 4;
+
+            for (uint32_t i = 0; i < count; i++)
+            {
+                ee->step();
+                if (ee->skip_branch_delay)
+                    i++;
+            }
+
+            ee->pc = ee->next_instr.pc;
+            ee->skip_branch_delay = false;
+            ee->branch_taken = false;
+        }
+
+        void Lockstep::run()
+        {
+            while (ee->cycles_to_execute > 0)
+            {
+                uint32_t pc = ee->pc;
+                BlockFunc code = lookup_next_block(ee);
+                auto& block = compiler->block_cache[pc];
+                uint32_t end = block.end;
+
+                /* The block might invalidate itself, hold on to what it was emitted from */
+                auto ir = block.ir;
+
+                /* Interpreter first. Its writes to memory are undone afterwards
+                   and its MMIO writes never reach the devices */
+                CpuState before = save_state(ee);
+                WriteJournal interpreter_writes;
+                interpreter_writes.apply_mmio = false;
+
+                ee->journal = &interpreter_writes;
+                interpret_block(pc, block.ranges);
+                ee->journal = nullptr;
+
+                CpuState expected = save_state(ee);
+                for (auto write = interpreter_writes.writes.rbegin(); write != interpreter_writes.writes.rend(); write++)
+                {
+                    if (auto memory = ee->memory_ptr(write->paddr))
+                        std::memcpy(memory, write->old_data, write->size);
+                }
+
+                /* Then the real thing */
+                restore_state(ee, before);
+                WriteJournal jit_writes;
+
+                ee->journal = &jit_writes;
+                compiler->trampoline(ee, code);
+                ee->journal = nullptr;
+
+                std::vector<std::string> diffs;
+                compare_state(expected, save_state(ee), diffs);
+                compare_writes(ee, interpreter_writes, jit_writes, diffs);
+                if (diffs.empty()) [[likely]]
+                    continue;
+
+                fmt::print("[JIT] Lockstep mismatch in block {:#x} - {:#x}\n", pc, end);
+                for (auto& diff : diffs)
+                    fmt::print("    {}\n", diff);
+
+                /* Blocks compiled before switching to lockstep don't keep their IR */
+                if (ir)
+                {
+                    fmt::print("[JIT] Block IR:\n");
+                    for (auto& instr : *ir)
+                    {
+                        fmt::print("    {:#010x}: {:08x} {} rd: {} rs: {} rt: {} sa: {} imm: {:#x}\n", instr.pc, instr.value,
+                                   operation_name(instr.operation), instr.destination, instr.source, instr.target,
+                                   instr.shift, instr.immediate);
+                    }
+                }
+
+                common::Emulator::terminate("[JIT] Lockstep mismatch at PC: {:#x}\n", pc);
+            }
+        }
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cpu/ee/jit/ir.h>
+#include <cstdint>
+#include <vector>
+
+namespace ee
+{
+    struct EmotionEngine;
+
+	namespace jit
+	{
+        struct JITCompiler;
+
+        /* Differential testing of the JIT against the interpreter. Every block is
+           first interpreted, then its state and memory writes are rolled back and
+           the compiled block runs from the same state. Registers, COP0/COP1, VU0
+           and the memory writes of both runs have to match, otherwise the emulator
+           stops with a report of the block. Blocks are not linked in this mode */
+        struct Lockstep
+        {
+            Lockstep(JITCompiler* compiler, EmotionEngine* ee);
+
+            /* Run the EE timeslice one block at a time */
+            void run();
+
+        private:
+            /* Run the instructions of the block through the interpreter.
+               Leaves the state the way the compiled block would */
+            void interpret_block(uint32_t pc, const std::vector<IRRange>& ranges);
+
+            JITCompiler* compiler;
+            EmotionEngine* ee;
+        };
+	}
+}
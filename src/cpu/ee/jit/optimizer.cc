@@ -0,0 +1,209 @@
+#include <cpu/ee/jit/optimizer.h>
+#include <algorithm>
+
+namespace ee
+{
+	namespace jit
+	{
+        namespace optimizer
+        {
+            /* Instructions that do nothing but write their destination GPR */
+            static bool is_pure(const IRInstruction& instr)
+            {
+                switch (instr.operation)
+                {
+                case IROperation::AddWord:
+                case IROperation::AddDword:
+                case IROperation::SubWord:
+                case IROperation::SubDword:
+                case IROperation::AndWord:
+                case IROperation::OrWord:
+                case IROperation::XorWord:
+                case IROperation::NorWord:
+                case IROperation::SetLessThanWord:
+                case IROperation::LogicalShiftLeftWord:
+                case IROperation::LogicalShiftRightWord:
+                case IROperation::ArithmeticShiftRightWord:
+                case IROperation::LogicalShiftLeftDword:
+                case IROperation::LogicalShiftRightDword:
+                case IROperation::ArithmeticShiftRightDword:
+                case IROperation::LoadUpperImmediate:
+                case IROperation::LoadConstant:
+                case IROperation::Move:
+                    return true;
+                default:
+                    return false;
+                }
+            }
+
+            static bool is_memory_access(const IRInstruction& instr)
+            {
+                return instr.operation >= IROperation::LoadByte &&
+                       instr.operation <= IROperation::StoreQwordCop2 &&
+                       instr.operation != IROperation::LoadUpperImmediate;
+            }
+
+            /* Computes the 64bit result of a pure instruction from known inputs.
+               Mirrors the interpreter, including the sign extension of word results */
+            static int64_t evaluate(const IRInstruction& instr, const int64_t* values)
+            {
+                int64_t rs = values[instr.source];
+                int64_t rt = values[instr.target];
+                int64_t imm = (int16_t)instr.immediate;
+
+                switch (instr.operation)
+                {
+                case IROperation::AddWord:
+                    return (int32_t)(rs + (instr.immediate_data ? imm : rt));
+                case IROperation::AddDword:
+                    return rs + (instr.immediate_data ? imm : rt);
+                case IROperation::SubWord:
+                    return (int32_t)(rs - rt);
+                case IROperation::SubDword:
+                    return rs - rt;
+                case IROperation::AndWord:
+                    return rs & (instr.immediate_data ? (uint16_t)instr.immediate : rt);
+                case IROperation::OrWord:
+                    return rs | (instr.immediate_data ? (uint16_t)instr.immediate : rt);
+                case IROperation::XorWord:
+                    return rs ^ (instr.immediate_data ? (uint16_t)instr.immediate : rt);
+                case IROperation::NorWord:
+                    return ~(rs | rt);
+                case IROperation::SetLessThanWord:
+                {
+                    int64_t operand = instr.immediate_data ? imm : rt;
+                    if (instr.signed_data)
+                        return rs < operand;
+                    return (uint64_t)rs < (uint64_t)operand;
+                }
+                case IROperation::LogicalShiftLeftWord:
+                case IROperation::LogicalShiftRightWord:
+                case IROperation::ArithmeticShiftRightWord:
+                {
+                    uint32_t amount = instr.immediate_data ? instr.shift : rs & 0x1f;
+                    uint32_t value = rt;
+                    if (instr.operation == IROperation::LogicalShiftLeftWord)
+                        return (int32_t)(value << amount);
+                    if (instr.operation == IROperation::LogicalShiftRightWord)
+                        return (int32_t)(value >> amount);
+                    return (int32_t)value >> amount;
+                }
+                case IROperation::LogicalShiftLeftDword:
+                case IROperation::LogicalShiftRightDword:
+                case IROperation::ArithmeticShiftRightDword:
+                {
+                    uint32_t amount = instr.immediate_data ? instr.shift : rs & 0x3f;
+                    if (instr.operation == IROperation::LogicalShiftLeftDword)
+                        return (uint64_t)rt << amount;
+                    if (instr.operation == IROperation::LogicalShiftRightDword)
+                        return (uint64_t)rt >> amount;
+                    return rt >> amount;
+                }
+                case IROperation::LoadUpperImmediate:
+                    return (int32_t)(instr.immediate << 16);
+                case IROperation::LoadConstant:
+                    return instr.signed_data ? (int64_t)(int32_t)instr.immediate : (int64_t)instr.immediate;
+                case IROperation::Move:
+                {
+                    bool move = instr.condition == BranchCond::Equal ? rt == 0 : rt != 0;
+                    return move ? rs : values[instr.destination];
+                }
+                default:
+                    return 0;
+                }
+            }
+
+            void fold_constants(IRBlock& block)
+            {
+                int64_t values[32] = {};
+                uint32_t known = 1;
+
+                for (int i = 0; i < block.size(); i++)
+                {
+                    auto& instr = block[i];
+                    if (is_memory_access(instr) && (known & (1u << instr.source)))
+                    {
+                        instr.constant_address = true;
+                        instr.address = values[instr.source] + (int16_t)instr.immediate;
+                    }
+
+                    uint32_t writes = instr.gpr_writes();
+                    bool foldable = is_pure(instr) && !(instr.gpr_reads() & ~known);
+
+                    /* Whatever we can't evaluate becomes unknown */
+                    known &= ~writes;
+                    known |= 1;
+
+                    if (!foldable)
+                        continue;
+
+                    int64_t result = evaluate(instr, values);
+                    uint16_t dest = __builtin_ctz(writes);
+                    if (dest == 0)
+                        continue;
+
+                    /* A likely branch may skip its delay slot, so its result
+                       can't be relied on afterwards */
+                    bool conditional = i > 0 && block[i - 1].is_likely_branch;
+                    if (!conditional)
+                    {
+                        values[dest] = result;
+                        known |= writes;
+                    }
+
+                    /* LoadConstant holds sign extended 32bit values */
+                    if (result == (int32_t)result)
+                    {
+                        instr.operation = IROperation::LoadConstant;
+                        instr.target = dest;
+                        instr.immediate = result;
+                        instr.immediate_data = true;
+                        instr.signed_data = true;
+                        instr.handler = nullptr;
+                    }
+                }
+            }
+
+            void eliminate_dead_code(IRBlock& block)
+            {
+                /* Every register is observable once the block exits */
+                uint32_t needed = ~0u;
+
+                for (int i = block.size() - 1; i >= 0; i--)
+                {
+                    auto& instr = block[i];
+                    uint32_t writes = instr.gpr_writes();
+
+                    if (is_pure(instr) && !(writes & needed & ~1u))
+                    {
+                        instr.operation = IROperation::None;
+                        instr.handler = nullptr;
+                        continue;
+                    }
+
+                    /* The delay slot of a likely branch might not run, so it can't hide
+                       earlier writes. Neither can an instruction with unknown writes */
+                    bool conditional = i > 0 && block[i - 1].is_likely_branch;
+                    if (!conditional && writes != ~0u)
+                        needed &= ~writes;
+                    needed |= instr.gpr_reads();
+                }
+            }
+
+            void strip_nops(IRBlock& block)
+            {
+                auto& instructions = block.instructions;
+                instructions.erase(std::remove_if(instructions.begin(), instructions.end(),
+                                                  [](const IRInstruction& instr) { return instr.operation == IROperation::None; }),
+                                   instructions.end());
+            }
+
+            void optimize(IRBlock& block)
+            {
+                fold_constants(block);
+                eliminate_dead_code(block);
+                strip_nops(block);
+            }
+        }
+	}
+}
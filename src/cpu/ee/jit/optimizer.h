@@ -0,0 +1,28 @@
+#pragma once
+#include <cpu/ee/jit/ir.h>
+
+namespace ee
+{
+	namespace jit
+	{
+        /* Passes that run on every block between IR generation and native emission.
+           They preserve guest semantics at block boundaries and around fallbacks */
+        namespace optimizer
+        {
+            /* Evaluate instructions whose inputs are known and turn them into
+               LoadConstant. Known base registers are also resolved into the
+               address of loads and stores */
+            void fold_constants(IRBlock& block);
+
+            /* Remove side effect free writes to GPRs that get overwritten
+               before anyone reads them, along with the writes to GPR[0] */
+            void eliminate_dead_code(IRBlock& block);
+
+            /* Drop instructions that don't emit anything */
+            void strip_nops(IRBlock& block);
+
+            /* Run the whole pipeline */
+            void optimize(IRBlock& block);
+        }
+	}
+}
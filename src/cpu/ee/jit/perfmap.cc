@@ -0,0 +1,59 @@
+#include <cpu/ee/jit/perfmap.h>
+#include <fmt/format.h>
+#include <unistd.h>
+
+namespace ee
+{
+	namespace jit
+	{
+        PerfMap::~PerfMap()
+        {
+            if (file)
+                fclose(file);
+        }
+
+        void PerfMap::enable()
+        {
+            if (file)
+                return;
+
+            auto path = fmt::format("/tmp/perf-{}.map", getpid());
+            file = fopen(path.c_str(), "w");
+            if (!file)
+                fmt::print("[JIT] Could not open {} for writing\n", path);
+        }
+
+        void PerfMap::add_symbol(uint32_t address, uint32_t size, const std::string& name)
+        {
+            symbols[address] = Symbol{ size, name };
+        }
+
+        void PerfMap::add_code(const void* code, size_t size, const std::string& name)
+        {
+            if (!file)
+                return;
+
+            /* START SIZE name, both numbers in hex. perf reads the file
+               when the process exits, so keep it up to date */
+            fmt::print(file, "{:x} {:x} {}\n", reinterpret_cast<uintptr_t>(code), size, name);
+            fflush(file);
+        }
+
+        void PerfMap::add_block(const void* code, size_t size, uint32_t pc, uint32_t end)
+        {
+            if (!file)
+                return;
+
+            auto name = fmt::format("ee_block_{:08x}_{:08x}", pc, end);
+            if (auto symbol = symbols.upper_bound(pc); symbol != symbols.begin())
+            {
+                symbol--;
+                uint32_t offset = pc - symbol->first;
+                if (offset < symbol->second.size)
+                    name += fmt::format(" [{}+{:#x}]", symbol->second.name, offset);
+            }
+
+            add_code(code, size, name);
+        }
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+
+namespace ee
+{
+	namespace jit
+	{
+        /* Writes /tmp/perf-<pid>.map so Linux perf can name JIT code. Blocks are
+           named after their guest PC and the guest function they belong to, if
+           the loaded ELF had a symbol table */
+        struct PerfMap
+        {
+            ~PerfMap();
+
+            /* Start writing the map. Code published before this stays anonymous */
+            void enable();
+            bool enabled() const { return file != nullptr; }
+
+            /* Guest function symbols, used to name blocks */
+            void add_symbol(uint32_t address, uint32_t size, const std::string& name);
+
+            /* Record host code, named directly or after the guest code it was translated from */
+            void add_code(const void* code, size_t size, const std::string& name);
+            void add_block(const void* code, size_t size, uint32_t pc, uint32_t end);
+
+        private:
+            struct Symbol
+            {
+                uint32_t size;
+                std::string name;
+            };
+
+            FILE* file = nullptr;
+            std::map<uint32_t, Symbol> symbols;
+        };
+	}
+}
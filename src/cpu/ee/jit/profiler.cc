@@ -0,0 +1,118 @@
+#include <cpu/ee/jit/profiler.h>
+#include <cpu/ee/jit/codecache.h>
+#include <fmt/format.h>
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+
+namespace ee
+{
+	namespace jit
+	{
+        static volatile sig_atomic_t dump_requested = 0;
+
+        static void request_dump(int)
+        {
+            dump_requested = 1;
+        }
+
+        Profiler::~Profiler()
+        {
+            if (active)
+                dump();
+        }
+
+        void Profiler::enable(const std::string& path, size_t report_size)
+        {
+            this->path = path;
+            this->report_size = report_size;
+            active = true;
+
+            std::signal(SIGUSR1, request_dump);
+        }
+
+        BlockProfile* Profiler::profile(uint32_t pc)
+        {
+            auto& profile = blocks[pc];
+            profile.pc = pc;
+            return &profile;
+        }
+
+        std::vector<const BlockProfile*> Profiler::hottest(size_t count) const
+        {
+            std::vector<const BlockProfile*> result;
+            for (auto& [pc, profile] : blocks)
+                result.push_back(&profile);
+
+            count = std::min(count, result.size());
+            std::partial_sort(result.begin(), result.begin() + count, result.end(),
+                              [](auto a, auto b) { return a->host_cycles > b->host_cycles; });
+            result.resize(count);
+            return result;
+        }
+
+        void Profiler::dump() const
+        {
+            FILE* file = fopen(path.c_str(), "w");
+            if (!file)
+            {
+                fmt::print("[JIT] Could not write the block profile to {}\n", path);
+                return;
+            }
+
+            bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+            auto blocks = hottest(report_size);
+            CodeCacheStats cache = code_cache ? code_cache->stats() : CodeCacheStats{};
+
+            if (json)
+            {
+                fmt::print(file, "{{\n  \"total_cycles\": {},\n  \"frame_cycles\": {},\n", total_cycles, frame_cycles);
+                fmt::print(file, "  \"code_cache\": {{ \"capacity\": {}, \"used\": {}, \"peak\": {}, \"flushes\": {} }},\n",
+                           cache.capacity, cache.used, cache.peak, cache.flushes);
+                fmt::print(file, "  \"blocks\": [\n");
+            }
+            else
+                fmt::print(file, "pc,end,ir_count,code_size,executions,host_cycles,share,ee_share,compilations,compile_ns\n");
+
+            for (size_t i = 0; i < blocks.size(); i++)
+            {
+                auto block = blocks[i];
+                /* Of the frame time, and of the time spent in the EE alone */
+                double share = frame_cycles ? (double)block->host_cycles / frame_cycles : 0.0;
+                double ee_share = total_cycles ? (double)block->host_cycles / total_cycles : 0.0;
+                if (json)
+                {
+                    fmt::print(file, "    {{ \"pc\": \"{:#x}\", \"end\": \"{:#x}\", \"ir_count\": {}, \"code_size\": {}, "
+                                     "\"executions\": {}, \"host_cycles\": {}, \"share\": {:.6f}, \"ee_share\": {:.6f}, "
+                                     "\"compilations\": {}, \"compile_ns\": {} }}{}\n",
+                               block->pc, block->end, block->ir_count, block->code_size, block->executions,
+                               block->host_cycles, share, ee_share, block->compilations, block->compile_ns,
+                               i + 1 < blocks.size() ? "," : "");
+                }
+                else
+                {
+                    fmt::print(file, "{:#x},{:#x},{},{},{},{},{:.6f},{:.6f},{},{}\n", block->pc, block->end, block->ir_count,
+                               block->code_size, block->executions, block->host_cycles, share, ee_share,
+                               block->compilations, block->compile_ns);
+                }
+            }
+
+            if (json)
+                fmt::print(file, "  ]\n}}\n");
+
+            fclose(file);
+            fmt::print("[JIT] Wrote the profile of {} blocks to {}\n", blocks.size(), path);
+            fmt::print("[JIT] Code cache: {} of {} bytes used, peak {}, {} flushes\n",
+                       cache.used, cache.capacity, cache.peak, cache.flushes);
+        }
+
+        void Profiler::poll()
+        {
+            if (dump_requested)
+            {
+                dump_requested = 0;
+                dump();
+            }
+        }
+	}
+}
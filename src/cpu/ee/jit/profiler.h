@@ -0,0 +1,69 @@
+#pragma once
+#include <robin_hood.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ee
+{
+	namespace jit
+	{
+        struct CodeCache;
+
+        /* Statistics of the block at a guest PC. They survive
+           recompilation, so repeated compiles show up here */
+        struct BlockProfile
+        {
+            uint32_t pc = 0, end = 0;
+            uint32_t ir_count = 0, code_size = 0;
+
+            /* Updated by the instrumented block itself */
+            uint64_t executions = 0;
+            uint64_t host_cycles = 0;
+            uint64_t entry_tsc = 0;
+
+            uint32_t compilations = 0;
+            uint64_t compile_ns = 0;
+        };
+
+        /* Optional per block profiling of JIT code. Instrumented blocks count their
+           executions and the host TSC cycles spent in them. The report of the hottest
+           blocks is written as CSV, or JSON if the path ends in .json, on exit and
+           whenever the process receives SIGUSR1 */
+        struct Profiler
+        {
+            ~Profiler();
+
+            /* Blocks compiled from now on are instrumented */
+            void enable(const std::string& path, size_t report_size = 100);
+            bool enabled() const { return active; }
+
+            /* Counters of the block at the PC, the address stays valid */
+            BlockProfile* profile(uint32_t pc);
+
+            /* Host TSC cycles spent running the EE and emulating whole frames,
+               for the share of each block */
+            void add_run_time(uint64_t cycles) { total_cycles += cycles; }
+            void add_frame_time(uint64_t cycles) { frame_cycles += cycles; }
+
+            /* The most expensive blocks by host time */
+            std::vector<const BlockProfile*> hottest(size_t count) const;
+
+            /* The usage of the cache is part of the report */
+            void set_code_cache(const CodeCache* cache) { code_cache = cache; }
+
+            /* Write the report now, or if a signal asked for one */
+            void dump() const;
+            void poll();
+
+        private:
+            bool active = false;
+            std::string path;
+            size_t report_size = 0;
+            uint64_t total_cycles = 0, frame_cycles = 0;
+            const CodeCache* code_cache = nullptr;
+
+            robin_hood::unordered_node_map<uint32_t, BlockProfile> blocks;
+        };
+	}
+}
@@ -0,0 +1,154 @@
+#include <cpu/ee/jit/regalloc.h>
+#include <cpu/ee/ee.h>
+#include <algorithm>
+
+namespace ee
+{
+	namespace jit
+	{
+        namespace x86 = asmjit::x86;
+
+        const x86::Gp RegisterAllocator::pool[POOL_SIZE] = { x86::r12, x86::r13, x86::r14 };
+
+        x86::Mem gpr_ptr(uint16_t gpr)
+        {
+            return x86::qword_ptr(x86::rbx, offsetof(EmotionEngine, gpr) + gpr * sizeof(Register));
+        }
+
+        void RegisterAllocator::analyze(IRBlock& block, NativePredicate is_native)
+        {
+            int size = block.size();
+            spilled.assign(size, 0);
+            writes.assign(size, 0);
+            live_out.assign(size, 0);
+            allocated.clear();
+
+            /* Count how often native code touches each register */
+            int uses[32] = {};
+            std::vector<uint32_t> reads(size);
+            for (int i = 0; i < size; i++)
+            {
+                auto& instr = block[i];
+                reads[i] = instr.gpr_reads();
+                writes[i] = instr.gpr_writes();
+
+                if (!is_native(instr))
+                {
+                    /* SYSCALL and ERET end the block in the interpreter,
+                       write back everything before they run */
+                    spilled[i] = instr.is_branch ? ~0u : reads[i] | writes[i];
+                    continue;
+                }
+
+                for (int gpr = 1; gpr < 32; gpr++)
+                {
+                    uses[gpr] += (reads[i] >> gpr) & 1;
+                    uses[gpr] += (writes[i] >> gpr) & 1;
+                }
+            }
+
+            /* A register is live after an instruction if a later one
+               reads it before anything overwrites it */
+            uint32_t live = 0;
+            for (int i = size - 1; i >= 0; i--)
+            {
+                live_out[i] = live;
+                live = (live & ~writes[i]) | reads[i];
+            }
+            live_in = live;
+
+            /* Hand out the pool to the most used registers. A single
+               access is cheaper straight from memory */
+            int order[32];
+            for (int gpr = 0; gpr < 32; gpr++)
+                order[gpr] = gpr;
+
+            std::stable_sort(order, order + 32, [&](int a, int b) { return uses[a] > uses[b]; });
+            for (int i = 0; i < POOL_SIZE && uses[order[i]] >= 2; i++)
+            {
+                HostRegister host;
+                host.reg = pool[i];
+                host.gpr = order[i];
+                allocated.push_back(host);
+            }
+        }
+
+        void RegisterAllocator::load_live_in(x86::Assembler* builder)
+        {
+            for (auto& host : allocated)
+            {
+                if (live_in & (1u << host.gpr))
+                {
+                    builder->mov(host.reg, gpr_ptr(host.gpr));
+                    host.valid = true;
+                }
+            }
+        }
+
+        HostRegister* RegisterAllocator::lookup(uint16_t gpr)
+        {
+            for (auto& host : allocated)
+            {
+                if (host.gpr == gpr)
+                    return &host;
+            }
+
+            return nullptr;
+        }
+
+        const x86::Gp* RegisterAllocator::use(x86::Assembler* builder, uint16_t gpr, bool write)
+        {
+            auto host = lookup(gpr);
+            if (!host)
+                return nullptr;
+
+            if (write)
+            {
+                host->valid = true;
+                host->dirty = true;
+            }
+            else if (!host->valid)
+            {
+                builder->mov(host->reg, gpr_ptr(gpr));
+                host->valid = true;
+            }
+
+            return &host->reg;
+        }
+
+        void RegisterAllocator::spill(x86::Assembler* builder, int index)
+        {
+            for (auto& host : allocated)
+            {
+                if (host.dirty && (spilled[index] & (1u << host.gpr)))
+                {
+                    builder->mov(gpr_ptr(host.gpr), host.reg);
+                    host.dirty = false;
+                }
+            }
+        }
+
+        void RegisterAllocator::reload(x86::Assembler* builder, int index)
+        {
+            for (auto& host : allocated)
+            {
+                if (!(writes[index] & (1u << host.gpr)))
+                    continue;
+
+                /* Only pay for the load if someone is going to read the result */
+                host.valid = live_out[index] & (1u << host.gpr);
+                if (host.valid)
+                    builder->mov(host.reg, gpr_ptr(host.gpr));
+            }
+        }
+
+        void RegisterAllocator::writeback(x86::Assembler* builder, uint32_t mask) const
+        {
+            for (auto& host : allocated)
+            {
+                if (host.dirty && (mask & (1u << host.gpr)))
+                    builder->mov(gpr_ptr(host.gpr), host.reg);
+            }
+        }
+	}
+}
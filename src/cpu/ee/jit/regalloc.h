@@ -0,0 +1,65 @@
+#pragma once
+#include <cpu/ee/jit/ir.h>
+#include <asmjit/asmjit.h>
+#include <vector>
+
+namespace ee
+{
+	namespace jit
+	{
+        /* Memory operand of a guest GPR, relative to the EmotionEngine pointer in rbx */
+        asmjit::x86::Mem gpr_ptr(uint16_t gpr);
+
+        /* A host register caching the value of a guest GPR */
+        struct HostRegister
+        {
+            asmjit::x86::Gp reg;
+            uint16_t gpr = 0;
+
+            /* valid: the host register holds the current value
+               dirty: the value in memory is stale */
+            bool valid = false, dirty = false;
+        };
+
+        /* Keeps the most used guest GPRs of a block in callee saved host
+           registers. The block is linear, so the state of each register
+           is known at every point of the emitted code. */
+        struct RegisterAllocator
+        {
+            using NativePredicate = bool(*)(const IRInstruction&);
+
+            /* Run liveness analysis over the block and assign host registers */
+            void analyze(IRBlock& block, NativePredicate is_native);
+
+            /* Load the allocated registers that are live on block entry */
+            void load_live_in(asmjit::x86::Assembler* builder);
+
+            /* Returns the host register of the guest GPR or nullptr when it lives in memory.
+               Reads reload an invalidated register, writes mark it dirty */
+            const asmjit::x86::Gp* use(asmjit::x86::Assembler* builder, uint16_t gpr, bool write);
+
+            /* Interpreter fallbacks access the GPRs in memory, so write back
+               what they need before the call and pick up their results after */
+            void spill(asmjit::x86::Assembler* builder, int index);
+            void reload(asmjit::x86::Assembler* builder, int index);
+
+            /* Write back dirty registers at a block exit or an out of line slow path.
+               The state is left untouched as the code after it still uses it */
+            void writeback(asmjit::x86::Assembler* builder, uint32_t mask = ~0u) const;
+
+            /* Host registers handed out by the allocator. All of them are callee saved,
+               r15 holds the fastmem base */
+            static constexpr int POOL_SIZE = 3;
+            static const asmjit::x86::Gp pool[POOL_SIZE];
+
+        private:
+            HostRegister* lookup(uint16_t gpr);
+
+            std::vector<HostRegister> allocated;
+
+            /* Per instruction GPR masks */
+            std::vector<uint32_t> spilled, writes, live_out;
+            uint32_t live_in = 0;
+        };
+	}
+}
@@ -229,8 +229,8 @@ namespace ee
         int16_t imm = (int16_t)ee->instr.i_type.immediate;
 
         /* TODO: Overflow detection */
-        int64_t reg = ee->gpr[rs].dword[0];
-        ee->gpr[rt].dword[0] = reg + imm;
+        int32_t reg = ee->gpr[rs].word[0];
+        ee->gpr[rt].dword[0] = (int32_t)(reg + imm);
 
         log("ADDI: ee->gpr[{:d}] = ee->gpr[{:d}] ({:#x}) + {:#x}\n", rt, rs, reg, imm);
     }
@@ -551,7 +551,7 @@ namespace ee
 
         uint64_t lo = ee->lo0 & 0xFFFFFFFF;
         uint64_t hi = ee->hi0 & 0xFFFFFFFF;
-        int64_t result = (hi << 32 | lo) + (int64_t)ee->gpr[rs].word[0] * (int64_t)ee->gpr[rt].word[0];
+        int64_t result = (hi << 32 | lo) + (int64_t)(int32_t)ee->gpr[rs].word[0] * (int32_t)ee->gpr[rt].word[0];
 
         ee->lo0 = (int64_t)(int32_t)(result & 0xFFFFFFFF);
         ee->hi0 = (int64_t)(int32_t)(result >> 32);
@@ -569,13 +569,15 @@ namespace ee
         {
             ee->lo1 = (int64_t)(int32_t)(ee->gpr[rs].word[0] / ee->gpr[rt].word[0]);
             ee->hi1 = (int64_t)(int32_t)(ee->gpr[rs].word[0] % ee->gpr[rt].word[0]);
-
-            log("DIVU1: ee->gpr[{:d}] ({:#x}) / ee->gpr[{:d}] ({:#x}) OUTPUT ee->lo1 = {:#x} and ee->hi1 = {:#x}\n", rs, ee->gpr[rs].word[0], rt, ee->gpr[rt].word[0], ee->lo1, ee->hi1);
         }
         else [[unlikely]]
         {
-            log("[ERROR] DIVU1: Division by zero!\n");
+            /* Same result as DIVU, the R5900 doesn't trap */
+            ee->hi1 = (int32_t)ee->gpr[rs].word[0];
+            ee->lo1 = (int32_t)0xffffffff;
         }
+
+        log("DIVU1: ee->gpr[{:d}] ({:#x}) / ee->gpr[{:d}] ({:#x}) OUTPUT ee->lo1 = {:#x} and ee->hi1 = {:#x}\n", rs, ee->gpr[rs].word[0], rt, ee->gpr[rt].word[0], ee->lo1, ee->hi1);
     }
 
     void op_mflo1(EmotionEngine* ee)
@@ -604,8 +606,8 @@ namespace ee
         uint16_t rs = ee->instr.r_type.rs;
         uint16_t rd = ee->instr.r_type.rd;
 
-        int64_t reg1 = (int64_t)ee->gpr[rs].dword[0];
-        int64_t reg2 = (int64_t)ee->gpr[rt].dword[0];
+        int64_t reg1 = (int32_t)ee->gpr[rs].word[0];
+        int64_t reg2 = (int32_t)ee->gpr[rt].word[0];
         int64_t result = reg1 * reg2;
         ee->gpr[rd].dword[0] = ee->lo1 = (int32_t)(result & 0xFFFFFFFF);
         ee->hi1 = (int32_t)(result >> 32);
@@ -1053,8 +1055,10 @@ namespace ee
         uint16_t rt = ee->instr.r_type.rt;
 
         uint64_t result = (uint64_t)ee->gpr[rs].word[0] * ee->gpr[rt].word[0];
-        ee->gpr[rd].dword[0] = ee->lo0 = result & 0xFFFFFFFF;
-        ee->hi0 = result >> 32;
+
+        /* HI and LO are sign extended even for the unsigned multiply */
+        ee->gpr[rd].dword[0] = ee->lo0 = (int32_t)(result & 0xFFFFFFFF);
+        ee->hi0 = (int32_t)(result >> 32);
 
         log("MULTU\n");
     }
@@ -1156,6 +1160,18 @@ namespace ee
         log("SQC2: Writing VF[{}] to address {:#x}\n", ft, vaddr);
     }
 
+    void op_lqc2(EmotionEngine* ee)
+    {
+        uint16_t ft = ee->instr.i_type.rt;
+        uint16_t base = ee->instr.i_type.rs;
+        int16_t offset = (int16_t)ee->instr.i_type.immediate;
+
+        uint32_t vaddr = offset + ee->gpr[base].word[0];
+        ee->emulator->vu[0]->regs.vf[ft].qword = ee->read<uint128_t>(vaddr);
+
+        log("LQC2: Reading VF[{}] from address {:#x}\n", ft, vaddr);
+    }
+
     void op_dsra(EmotionEngine* ee)
     {
         uint16_t sa = ee->instr.r_type.sa;
@@ -1289,6 +1305,7 @@ namespace ee
         {
         case 0: ee->gpr[rt].dword[0] = (int32_t)ee->cop1.fcr0.value; break;
         case 31: ee->gpr[rt].dword[0] = (int32_t)ee->cop1.fcr31.value; break;
+        default: ee->gpr[rt].dword[0] = 0; break;
         }
     }
 
@@ -1665,7 +1682,7 @@ namespace ee
 
         uint64_t lo = ee->lo1 & 0xFFFFFFFF;
         uint64_t hi = ee->hi1 & 0xFFFFFFFF;
-        int64_t result = (hi << 32 | lo) + (int64_t)ee->gpr[rs].word[0] * (int64_t)ee->gpr[rt].word[0];
+        int64_t result = (hi << 32 | lo) + (int64_t)(int32_t)ee->gpr[rs].word[0] * (int32_t)ee->gpr[rt].word[0];
 
         ee->lo1 = (int64_t)(int32_t)(result & 0xFFFFFFFF);
         ee->hi1 = (int64_t)(int32_t)(result >> 32);
@@ -1817,8 +1834,8 @@ namespace ee
         uint16_t rs = ee->instr.r_type.rs;
         uint16_t rd = ee->instr.r_type.rd;
 
-        int64_t reg1 = (int64_t)ee->gpr[rs].dword[0];
-        int64_t reg2 = (int64_t)ee->gpr[rt].dword[0];
+        int64_t reg1 = (int32_t)ee->gpr[rs].word[0];
+        int64_t reg2 = (int32_t)ee->gpr[rt].word[0];
         int64_t result = reg1 * reg2;
 
         ee->gpr[rd].dword[0] = ee->lo0 = (int32_t)(result & 0xFFFFFFFF);
@@ -102,6 +102,7 @@ namespace ee
     void op_swl(EmotionEngine* ee);
     void op_swr(EmotionEngine* ee);
     void op_sqc2(EmotionEngine* ee);
+    void op_lqc2(EmotionEngine* ee);
     void op_dsra(EmotionEngine* ee);
     void op_sub(EmotionEngine* ee);
     void op_add(EmotionEngine* ee);
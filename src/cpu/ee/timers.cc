@@ -2,6 +2,7 @@
 #include <cpu/ee/intc.h>
 #include <common/emulator.h>
 #include <fmt/core.h>
+#include <algorithm>
 #include <cassert>
 
 static const char* REGS[] =
@@ -87,6 +88,33 @@ namespace ee
 		*ptr = data;
 	}
 
+	uint32_t Timers::cycles_until_event()
+	{
+		uint32_t cycles = UINT32_MAX;
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			auto& timer = timers[i];
+
+			if (!timer.mode.enable || !timer.ratio || timer.counter > 0xffff)
+				continue;
+
+			/* Only the edges that raise an interrupt matter to the EE */
+			if (timer.mode.cmp_intr_enable && !timer.mode.cmp_flag && timer.counter < timer.compare)
+			{
+				uint32_t distance = timer.compare - timer.counter;
+				cycles = std::min(cycles, (distance + timer.ratio - 1) / timer.ratio);
+			}
+
+			if (timer.mode.overflow_intr_enable && !timer.mode.overflow_flag)
+			{
+				uint32_t distance = 0x10000 - timer.counter;
+				cycles = std::min(cycles, (distance + timer.ratio - 1) / timer.ratio);
+			}
+		}
+
+		return cycles;
+	}
+
 	void Timers::tick(uint32_t cycles)
 	{
 		for (uint32_t i = 0; i < 3; i++)
@@ -54,6 +54,9 @@ namespace ee
 
 		void tick(uint32_t cycles);
 
+		/* BUSCLK cycles until the next timer interrupt */
+		uint32_t cycles_until_event();
+
 		uint32_t read(uint32_t addr);
 		void write(uint32_t addr, uint32_t data);
 